@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <dvdread/dvd_reader.h>
+#include <dvdread/ifo_read.h>
+
+#include <libavformat/avio.h>
+#include <libavformat/avformat.h>
+
+#include "common.h"
+
+static void help(char *name)
+{
+    fprintf(stderr, "%s [-s] <path>\n"
+            "path: The path to a dvd-video file layout, unencrypted\n"
+            "-s:   read every sector instead of the index or the NAV links\n"
+            "Every mismatch is printed as\n"
+            "<file> <table> <entry> <field> <found> <expected>\n",
+            name);
+    exit(0);
+}
+
+typedef struct CheckContext {
+    char file[16];      ///< the IFO or VOB being checked
+    int mismatches;
+    int full_scan;      ///< trust neither the .idx nor the vobu_ea
+} CheckContext;
+
+static void check(CheckContext *c, const char *table, int entry,
+                  const char *field, uint32_t found, uint32_t expected)
+{
+    if (found == expected)
+        return;
+
+    printf("%s %s %d %s 0x%08"PRIx32" 0x%08"PRIx32"\n",
+           c->file, table, entry, field, found, expected);
+    c->mismatches++;
+}
+
+static void missing_cell(CheckContext *c, const char *table, int entry,
+                         int vob_id, int cell_id)
+{
+    printf("%s %s %d cell %d-%d missing\n",
+           c->file, table, entry, vob_id, cell_id);
+    c->mismatches++;
+}
+
+static void check_nav(CheckContext *c, VOBU *vobus, int nb_vobus)
+{
+    int i;
+
+    for (i = 0; i < nb_vobus; i++) {
+        VOBU *v = vobus + i;
+
+        check(c, "nav", i, "pci_nv_pck_lbn",
+              v->pci.pci_gi.nv_pck_lbn, v->start_sector);
+        check(c, "nav", i, "dsi_nv_pck_lbn",
+              v->dsi.dsi_gi.nv_pck_lbn, v->start_sector);
+        check(c, "nav", i, "vobu_ea",
+              v->dsi.dsi_gi.vobu_ea, v->end_sector - 1 - v->start_sector);
+        check(c, "nav", i, "next_vobu",
+              v->dsi.vobu_sri.next_vobu, v->next);
+    }
+}
+
+static void check_c_adt(CheckContext *c, c_adt_t *c_adt, CellIndex *ci)
+{
+    int i, map_size = (c_adt->last_byte + 1 - C_ADT_SIZE) / sizeof(cell_adr_t);
+
+    for (i = 0; i < map_size; i++) {
+        cell_adr_t *adr = c_adt->cell_adr_table + i;
+        CELL *cell      = find_cell(ci, adr->vob_id, adr->cell_id);
+
+        if (!cell) {
+            missing_cell(c, "c_adt", i, adr->vob_id, adr->cell_id);
+            continue;
+        }
+
+        check(c, "c_adt", i, "start_sector",
+              adr->start_sector, cell->start_sector);
+        check(c, "c_adt", i, "last_sector",
+              adr->last_sector, cell->last_sector);
+    }
+}
+
+/*
+ * Both lists are sorted, an entry pointing to no NAV pack and a NAV pack
+ * without entry are reported apart so one miss does not shift the rest.
+ */
+static void check_vobu_admap(CheckContext *c, vobu_admap_t *admap,
+                             VOBU *vobus, int nb_vobus)
+{
+    int i = 0, j = 0;
+    int map_size = (admap->last_byte + 1 - VOBU_ADMAP_SIZE) / sizeof(uint32_t);
+
+    check(c, "vobu_admap", 0, "nb_vobus", map_size, nb_vobus);
+
+    while (i < map_size || j < nb_vobus) {
+        uint32_t sector = i < map_size ? admap->vobu_start_sectors[i] : 0;
+
+        if (i < map_size && j < nb_vobus &&
+            sector == vobus[j].start_sector) {
+            i++;
+            j++;
+        } else if (j == nb_vobus ||
+                   (i < map_size && sector < vobus[j].start_sector)) {
+            check(c, "vobu_admap", i, "start_sector", sector,
+                  j < nb_vobus ? vobus[j].start_sector : 0);
+            i++;
+        } else {
+            printf("%s vobu_admap %d nav 0x%08"PRIx32" missing\n",
+                   c->file, i, vobus[j].start_sector);
+            c->mismatches++;
+            j++;
+        }
+    }
+}
+
+static void check_pgc(CheckContext *c, const char *table, pgc_t *pgc,
+                      CellIndex *ci)
+{
+    int i;
+
+    if (!pgc || !pgc->cell_playback)
+        return;
+
+    for (i = 0; i < pgc->nr_of_cells; i++) {
+        cell_playback_t *cp = pgc->cell_playback + i;
+        CELL *cell = find_cell(ci, pgc->cell_position[i].vob_id_nr,
+                               pgc->cell_position[i].cell_nr);
+
+        if (!cell) {
+            missing_cell(c, table, i, pgc->cell_position[i].vob_id_nr,
+                         pgc->cell_position[i].cell_nr);
+            continue;
+        }
+
+        check(c, table, i, "first_sector",
+              cp->first_sector, cell->start_sector);
+        check(c, table, i, "last_sector",
+              cp->last_sector, cell->last_sector);
+        check(c, table, i, "last_vobu_start_sector",
+              cp->last_vobu_start_sector, cell->last_vobu_start_sector);
+    }
+}
+
+static void check_pgcit(CheckContext *c, const char *prefix,
+                        pgcit_t *pgcit, CellIndex *ci)
+{
+    char table[32];
+    int i;
+
+    for (i = 0; i < pgcit->nr_of_pgci_srp; i++) {
+        snprintf(table, sizeof(table), "%spgc[%d]", prefix, i + 1);
+        check_pgc(c, table, pgcit->pgci_srp[i].pgc, ci);
+    }
+}
+
+static void check_pgci_ut(CheckContext *c, pgci_ut_t *pgci_ut, CellIndex *ci)
+{
+    char prefix[16];
+    int i;
+
+    for (i = 0; pgci_ut && i < pgci_ut->nr_of_lus; i++) {
+        snprintf(prefix, sizeof(prefix), "lu[%d].", i);
+        check_pgcit(c, prefix, pgci_ut->lu[i].pgcit, ci);
+    }
+}
+
+static int vobu_at_sector(VOBU *vobus, int nb_vobus, uint32_t sector)
+{
+    int lo = 0, hi = nb_vobus;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (vobus[mid].start_sector < sector)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * Every entry must point to the start of a VOBU of one of the cells of
+ * its PGC.
+ */
+static void check_tmapt(CheckContext *c, vts_tmapt_t *tmapt, pgcit_t *pgcit,
+                        VOBU *vobus, int nb_vobus)
+{
+    char table[32];
+    int i, j, k;
+
+    for (i = 0; i < tmapt->nr_of_tmaps && i < pgcit->nr_of_pgci_srp; i++) {
+        vts_tmap_t *tmap = tmapt->tmap + i;
+        pgc_t *pgc       = pgcit->pgci_srp[i].pgc;
+
+        snprintf(table, sizeof(table), "tmap[%d]", i + 1);
+
+        for (j = 0; pgc && j < tmap->nr_of_entries; j++) {
+            uint32_t sector = tmap->map_ent[j] & 0x7fffffff;
+            int v           = vobu_at_sector(vobus, nb_vobus, sector);
+
+            if (v == nb_vobus || vobus[v].start_sector != sector) {
+                check(c, table, j, "map_ent", sector,
+                      v < nb_vobus ? vobus[v].start_sector : 0);
+                continue;
+            }
+
+            for (k = 0; k < pgc->nr_of_cells; k++)
+                if (pgc->cell_position[k].vob_id_nr == vobus[v].vob_id &&
+                    pgc->cell_position[k].cell_nr == vobus[v].cell_id)
+                    break;
+
+            if (k == pgc->nr_of_cells)
+                missing_cell(c, table, j, vobus[v].vob_id, vobus[v].cell_id);
+        }
+    }
+}
+
+/*
+ * The title set sectors in the mat against the layout of the files.
+ */
+static void check_mat(CheckContext *c, ifo_handle_t *ifo,
+                      const DiscLayout *l, int idx)
+{
+    const TitleSetLayout *ts = l->ts + idx;
+    int32_t ifo_sectors      = size_to_sectors(ts->ifo_size);
+
+    if (ifo->vtsi_mat) {
+        check(c, "vtsi_mat", 0, "vts_last_sector",
+              ifo->vtsi_mat->vts_last_sector, title_set_sectors(ts) - 1);
+        check(c, "vtsi_mat", 0, "vtsi_last_sector",
+              ifo->vtsi_mat->vtsi_last_sector, ifo_sectors - 1);
+        check(c, "vtsi_mat", 0, "vtstt_vobs",
+              ifo->vtsi_mat->vtstt_vobs,
+              ifo_sectors + size_to_sectors(ts->menu_size));
+    }
+
+    if (ifo->vmgi_mat) {
+        int i;
+
+        check(c, "vmgi_mat", 0, "vmg_last_sector",
+              ifo->vmgi_mat->vmg_last_sector, title_set_sectors(ts) - 1);
+        check(c, "vmgi_mat", 0, "vmgi_last_sector",
+              ifo->vmgi_mat->vmgi_last_sector, ifo_sectors - 1);
+
+        for (i = 0; ifo->tt_srpt && i < ifo->tt_srpt->nr_of_srpts; i++) {
+            int nr = ifo->tt_srpt->title[i].title_set_nr;
+
+            check(c, "tt_srpt", i, "title_set_sector",
+                  ifo->tt_srpt->title[i].title_set_sector,
+                  nr <= l->nb_title_sets ? l->ts[nr].start_sector : 0);
+        }
+    }
+}
+
+static void check_domain(CheckContext *c, const char *url, c_adt_t *c_adt,
+                         vobu_admap_t *admap, ifo_handle_t *ifo, int title)
+{
+    VOBU *vobus = NULL;
+    CellIndex ci;
+    const char *domain = title ? "title" : "menu";
+    int nb_vobus;
+
+    // The saved index if it is still valid, otherwise only the NAV
+    // sectors are read.
+    if (c->full_scan)
+        nb_vobus = scan_vobs(&vobus, url);
+    else if ((nb_vobus = load_vobu_index(&vobus, url)) < 0)
+        nb_vobus = walk_vobs(&vobus, url);
+
+    if (nb_vobus < 0) {
+        printf("%s %s 0 vobus unreadable\n", c->file, domain);
+        c->mismatches++;
+        return;
+    }
+
+    if (populate_cell_index(&ci, vobus, nb_vobus) < 0) {
+        printf("%s %s 0 cells unreadable\n", c->file, domain);
+        c->mismatches++;
+        av_free(vobus);
+        return;
+    }
+
+    check_nav(c, vobus, nb_vobus);
+
+    if (c_adt)
+        check_c_adt(c, c_adt, &ci);
+    if (admap)
+        check_vobu_admap(c, admap, vobus, nb_vobus);
+
+    if (title) {
+        check_pgcit(c, "", ifo->vts_pgcit, &ci);
+        if (ifo->vts_tmapt)
+            check_tmapt(c, ifo->vts_tmapt, ifo->vts_pgcit, vobus, nb_vobus);
+    } else {
+        check_pgci_ut(c, ifo->pgci_ut, &ci);
+    }
+
+    free_cell_index(&ci);
+    av_free(vobus);
+}
+
+static void check_title_set(CheckContext *c, dvd_reader_t *dvd,
+                            const char *path, const DiscLayout *l, int idx)
+{
+    ifo_handle_t *ifo = ifoOpen(dvd, idx);
+    char url[4096];
+
+    if (idx)
+        snprintf(c->file, sizeof(c->file), "VTS_%02d_0.IFO", idx);
+    else
+        snprintf(c->file, sizeof(c->file), "VIDEO_TS.IFO");
+
+    if (!ifo) {
+        printf("%s unreadable\n", c->file);
+        c->mismatches++;
+        return;
+    }
+
+    check_mat(c, ifo, l, idx);
+
+    if (l->ts[idx].menu_size) {
+        if (idx)
+            snprintf(url, sizeof(url), "%s/VIDEO_TS/VTS_%02d_0.VOB", path, idx);
+        else
+            snprintf(url, sizeof(url), "%s/VIDEO_TS/VIDEO_TS.VOB", path);
+
+        check_domain(c, url, ifo->menu_c_adt, ifo->menu_vobu_admap, ifo, 0);
+    }
+
+    if (idx && l->ts[idx].title_size) {
+        title_parts(url, sizeof(url), path, idx);
+        check_domain(c, url, ifo->vts_c_adt, ifo->vts_vobu_admap, ifo, 1);
+    }
+
+    ifoClose(ifo);
+}
+
+int main(int argc, char **argv)
+{
+    CheckContext c = { { 0 } };
+    DiscLayout layout;
+    dvd_reader_t *dvd;
+    char *name = argv[0];
+    int i, opt;
+
+    av_register_all();
+
+    while ((opt = getopt(argc, argv, "s")) != -1) {
+        switch (opt) {
+        case 's':
+            c.full_scan = 1;
+            break;
+        default:
+            help(name);
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < 2)
+        help(name);
+
+    if (scan_disc_layout(&layout, argv[1]) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find VIDEO_TS.IFO in %s\n",
+               argv[1]);
+        return 1;
+    }
+
+    dvd = DVDOpen(argv[1]);
+    if (!dvd) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the path %s\n", argv[1]);
+        return 1;
+    }
+
+    for (i = 0; i <= layout.nb_title_sets; i++)
+        check_title_set(&c, dvd, argv[1], &layout, i);
+
+    DVDClose(dvd);
+
+    av_log(NULL, c.mismatches ? AV_LOG_ERROR : AV_LOG_INFO,
+           "%d mismatches in %d title sets\n",
+           c.mismatches, layout.nb_title_sets);
+
+    return !!c.mismatches;
+}
@@ -1,7 +1,13 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <libavformat/avio.h>
 #include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
 #include <libavutil/intreadwrite.h>
 
 #include <dvdread/nav_print.h>
@@ -125,7 +131,159 @@ redo:
     }
 }
 
-int populate_vobs(VOBU **v, const char *filename)
+static void link_vobu(VOBU *vobus, int i)
+{
+    if (vobus[i - 1].vob_id != vobus[i].vob_id ||
+        vobus[i - 1].cell_id != vobus[i].cell_id) {
+        vobus[i - 1].next = 0x3fffffff;
+    } else {
+        vobus[i - 1].next = vobus[i - 1].end_sector -
+                            vobus[i - 1].start_sector;
+    }
+    av_log(NULL, AV_LOG_DEBUG, "%d Values %d vs %d %d vs %d\n",
+           i - 1,
+           vobus[i - 1].vob_id, vobus[i].vob_id,
+           vobus[i - 1].cell_id, vobus[i].cell_id);
+}
+
+/*
+ * Set the next fields of the index again once VOBUs moved.
+ */
+void link_vobus(VOBU *vobus, int nb_vobus)
+{
+    int i;
+
+    for (i = 1; i < nb_vobus; i++)
+        link_vobu(vobus, i);
+
+    if (nb_vobus)
+        vobus[nb_vobus - 1].next = 0x3fffffff;
+}
+
+/*
+ * The index of a VOB can be kept in filename.idx, it is used as long
+ * as the size and the modification time of the VOB match the ones it
+ * was saved for.
+ */
+#define VOBU_INDEX_TAG MKTAG('V', 'I', 'D', 'X')
+
+typedef struct {
+    uint32_t tag;
+    uint32_t vobu_size;
+    int64_t size;
+    int64_t mtime_sec, mtime_nsec;
+    int32_t nb_vobus;
+} VOBUIndexHeader;
+
+static int index_header(VOBUIndexHeader *h, const char *filename)
+{
+    struct stat st;
+
+    if (strchr(filename, ':') || stat(filename, &st) < 0 ||
+        !S_ISREG(st.st_mode))
+        return -1;
+
+    memset(h, 0, sizeof(*h));
+    h->tag        = VOBU_INDEX_TAG;
+    h->vobu_size  = sizeof(VOBU);
+    h->size       = st.st_size;
+    h->mtime_sec  = st.st_mtim.tv_sec;
+    h->mtime_nsec = st.st_mtim.tv_nsec;
+
+    return 0;
+}
+
+int load_vobu_index(VOBU **v, const char *filename)
+{
+    VOBUIndexHeader h, ref;
+    VOBU *vobus = NULL;
+    char name[1024];
+    FILE *f;
+
+    if (index_header(&ref, filename) < 0)
+        return -1;
+
+    snprintf(name, sizeof(name), "%s.idx", filename);
+
+    if (!(f = fopen(name, "rb")))
+        return -1;
+
+    if (fread(&h, sizeof(h), 1, f) != 1 ||
+        h.tag != ref.tag || h.vobu_size != ref.vobu_size ||
+        h.size != ref.size || h.mtime_sec != ref.mtime_sec ||
+        h.mtime_nsec != ref.mtime_nsec || h.nb_vobus <= 0 ||
+        !(vobus = av_mallocz((h.nb_vobus + 1) * sizeof(VOBU))) ||
+        fread(vobus, sizeof(VOBU), h.nb_vobus, f) != h.nb_vobus) {
+        av_log(NULL, AV_LOG_VERBOSE, "Ignoring the stale %s\n", name);
+        av_free(vobus);
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+
+    vobus[h.nb_vobus].start_sector = -1; // Guard
+    *v = vobus;
+
+    return h.nb_vobus;
+}
+
+/*
+ * To be called once the VOB is written for good.
+ */
+int save_vobu_index(const VOBU *vobus, int nb_vobus, const char *filename)
+{
+    VOBUIndexHeader h;
+    char name[1024];
+    FILE *f;
+    int ret = 0;
+
+    if (index_header(&h, filename) < 0)
+        return AVERROR(EINVAL);
+
+    h.nb_vobus = nb_vobus;
+
+    snprintf(name, sizeof(name), "%s.idx", filename);
+
+    if (!(f = fopen(name, "wb"))) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot write %s\n", name);
+        return AVERROR(errno);
+    }
+
+    if (fwrite(&h, sizeof(h), 1, f) != 1 ||
+        fwrite(vobus, sizeof(VOBU), nb_vobus, f) != nb_vobus)
+        ret = AVERROR(EIO);
+
+    if (fclose(f) || ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot write %s\n", name);
+        unlink(name);
+        return AVERROR(EIO);
+    }
+
+    return 0;
+}
+
+/*
+ * To be called by whoever writes the VOB in place, the size and mtime
+ * may not tell the index is stale.
+ */
+void drop_vobu_index(const char *filename)
+{
+    char name[1024];
+
+    if (strchr(filename, ':'))
+        return;
+
+    snprintf(name, sizeof(name), "%s.idx", filename);
+
+    if (unlink(name) < 0 && errno != ENOENT)
+        av_log(NULL, AV_LOG_WARNING, "Cannot remove the stale %s\n", name);
+}
+
+/*
+ * Index every NAV pack of the file, reading it sector by sector.
+ */
+int scan_vobs(VOBU **v, const char *filename)
 {
     AVIOContext *in = NULL;
     VOBU *vobus = NULL;
@@ -148,19 +306,8 @@ int populate_vobs(VOBU **v, const char *filename)
         return -1;
 
     while (!find_vobu(in, vobus, i)) {
-        if (i) {
-            if (vobus[i - 1].vob_id != vobus[i].vob_id ||
-                vobus[i - 1].cell_id != vobus[i].cell_id) {
-                vobus[i - 1].next = 0x3fffffff;
-            } else {
-                vobus[i - 1].next = vobus[i - 1].end_sector -
-                                    vobus[i - 1].start_sector;
-            }
-            av_log(NULL, AV_LOG_DEBUG, "%d Values %d vs %d %d vs %d\n",
-                   i - 1,
-                   vobus[i - 1].vob_id, vobus[i].vob_id,
-                   vobus[i - 1].cell_id, vobus[i].cell_id);
-        }
+        if (i)
+            link_vobu(vobus, i);
         if (++i >= size - 1) {
             size *= 2;
             if (av_reallocp_array(&vobus, size, sizeof(VOBU)) < 0)
@@ -187,6 +334,113 @@ int populate_vobs(VOBU **v, const char *filename)
     return i;
 }
 
+int populate_vobs(VOBU **v, const char *filename)
+{
+    int nb_vobus = load_vobu_index(v, filename);
+
+    if (nb_vobus > 0)
+        return nb_vobus;
+
+    return scan_vobs(v, filename);
+}
+
+/*
+ * Build the same index populate_vobs does, trusting the vobu_ea in each
+ * NAV pack to jump to the next one. Only the NAV sectors are read as long
+ * as the file is consistent, a wrong jump falls back to a sector by sector
+ * scan from the last good NAV pack.
+ */
+int walk_vobs(VOBU **v, const char *filename)
+{
+    AVIOContext *in = NULL;
+    VOBU *vobus = NULL;
+    uint8_t buf[DVD_BLOCK_LEN];
+    int ret, i = 0, size = 1, jumped = 0;
+    int64_t end;
+    int32_t sector = 0, last = 0, nb_sectors;
+
+    ret = avio_open(&in, filename, AVIO_FLAG_READ);
+
+    if (ret < 0) {
+        char errbuf[128];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s: %s",
+               filename, errbuf);
+        return -1;
+    }
+
+    end        = avio_size(in);
+    nb_sectors = end / DVD_BLOCK_LEN;
+
+    if (av_reallocp_array(&vobus, size + 1, sizeof(VOBU)) < 0)
+        return -1;
+
+    while (sector < nb_sectors) {
+        avio_seek(in, (int64_t)sector * DVD_BLOCK_LEN, SEEK_SET);
+        if (avio_read(in, buf, sizeof(buf)) != sizeof(buf))
+            break;
+
+        if (parse_nav_sector(buf, &vobus[i]) || !vobus[i].vob_id) {
+            if (jumped) {
+                av_log(NULL, AV_LOG_VERBOSE,
+                       "No NAV at 0x%08"PRIx32", rescanning from 0x%08"PRIx32"\n",
+                       sector, last);
+                sector = last;
+                jumped = 0;
+            }
+            sector++;
+            continue;
+        }
+
+        vobus[i].start_sector = sector;
+        vobus[i].start        = (int64_t)sector * DVD_BLOCK_LEN;
+        if (i) {
+            vobus[i - 1].end        = vobus[i].start;
+            vobus[i - 1].end_sector = vobus[i].start_sector;
+            link_vobu(vobus, i);
+        }
+
+        last   = sector;
+        sector = sector + 1 + vobus[i].dsi.dsi_gi.vobu_ea;
+        jumped = 1;
+
+        // A jump past the end is as wrong as one landing off a NAV pack
+        if (sector > nb_sectors) {
+            av_log(NULL, AV_LOG_VERBOSE,
+                   "vobu_ea past the end at 0x%08"PRIx32", rescanning\n",
+                   last);
+            sector = last + 1;
+            jumped = 0;
+        }
+
+        if (++i >= size) {
+            size *= 2;
+            if (av_reallocp_array(&vobus, size + 1, sizeof(VOBU)) < 0)
+                return -1;
+        }
+    }
+
+    avio_close(in);
+
+    if (!i) {
+        av_log(NULL, AV_LOG_ERROR, "Empty %s",
+               filename);
+        av_free(vobus);
+        return -1;
+    }
+
+    vobus[i - 1].end        = end;
+    vobus[i - 1].end_sector = end / DVD_BLOCK_LEN;
+    vobus[i - 1].next       = 0x3fffffff;
+
+    memset(vobus + i, 0, sizeof(VOBU));
+    vobus[i].start_sector = -1; // Guard
+
+    *v = vobus;
+
+    return i;
+}
+
 int populate_cells(CELL **c, VOBU *vobus, int nb_vobus)
 {
     int i, j = 0;
@@ -216,3 +470,1005 @@ int populate_cells(CELL **c, VOBU *vobus, int nb_vobus)
 
     return j;
 }
+
+static uint32_t cell_key(int vob_id, int cell_id)
+{
+    return (uint32_t)vob_id << 8 | (cell_id & 0xff);
+}
+
+static int cell_slot(const CellIndex *ci, uint32_t key)
+{
+    return (key * 2654435761U) & (ci->nb_slots - 1);
+}
+
+/*
+ * The cells of the VOBU index with an open addressing table on top.
+ */
+int populate_cell_index(CellIndex *ci, VOBU *vobus, int nb_vobus)
+{
+    int i;
+
+    memset(ci, 0, sizeof(*ci));
+
+    if ((ci->nb_cells = populate_cells(&ci->cells, vobus, nb_vobus)) < 0)
+        return ci->nb_cells;
+
+    ci->nb_slots = 16;
+    while (ci->nb_slots < 2 * ci->nb_cells)
+        ci->nb_slots *= 2;
+
+    ci->slots = av_mallocz(ci->nb_slots * sizeof(*ci->slots));
+    if (!ci->slots)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < ci->nb_cells; i++) {
+        uint32_t key = cell_key(ci->cells[i].vob_id, ci->cells[i].cell_id);
+        int slot     = cell_slot(ci, key);
+
+        while (ci->slots[slot])
+            slot = (slot + 1) & (ci->nb_slots - 1);
+
+        ci->slots[slot] = i + 1;
+    }
+
+    return ci->nb_cells;
+}
+
+CELL *find_cell(CellIndex *ci, int vob_id, int cell_id)
+{
+    uint32_t key = cell_key(vob_id, cell_id);
+    int slot     = cell_slot(ci, key);
+
+    while (ci->slots[slot]) {
+        CELL *c = ci->cells + ci->slots[slot] - 1;
+
+        if (cell_key(c->vob_id, c->cell_id) == key)
+            return c;
+
+        slot = (slot + 1) & (ci->nb_slots - 1);
+    }
+
+    if (!av_reallocp_array(&ci->missing, ci->nb_missing + 1,
+                           sizeof(*ci->missing)))
+        ci->missing[ci->nb_missing++] = key;
+
+    return NULL;
+}
+
+static int cmp_key(const void *a, const void *b)
+{
+    uint32_t ka = *(const uint32_t *)a, kb = *(const uint32_t *)b;
+
+    return ka < kb ? -1 : ka > kb;
+}
+
+/*
+ * Log every cell looked up and not found once, returns their number.
+ */
+int report_missing_cells(CellIndex *ci, const char *what)
+{
+    int i, n = 0;
+
+    qsort(ci->missing, ci->nb_missing, sizeof(*ci->missing), cmp_key);
+
+    for (i = 0; i < ci->nb_missing; i++)
+        if (!i || ci->missing[i] != ci->missing[i - 1])
+            ci->missing[n++] = ci->missing[i];
+
+    if (n) {
+        av_log(NULL, AV_LOG_ERROR, "Missing %d cells in %s:", n, what);
+        for (i = 0; i < n; i++)
+            av_log(NULL, AV_LOG_ERROR, " %d-%d",
+                   ci->missing[i] >> 8, ci->missing[i] & 0xff);
+        av_log(NULL, AV_LOG_ERROR, "\n");
+    }
+
+    ci->nb_missing = 0;
+
+    return n;
+}
+
+void free_cell_index(CellIndex *ci)
+{
+    av_freep(&ci->cells);
+    av_freep(&ci->slots);
+    av_freep(&ci->missing);
+}
+
+/*
+ * Offset of the PES packet carried by the pack in the sector buf,
+ * skipping the pack stuffing and the optional system header.
+ */
+int pack_pes_offset(const uint8_t *buf)
+{
+    int off;
+
+    if (AV_RB32(buf) != PACK_START_CODE)
+        return -1;
+
+    off = 14 + (buf[13] & 7);
+
+    if (AV_RB32(buf + off) == SYSTEM_HEADER_START_CODE)
+        off += 6 + AV_RB16(buf + off + 4);
+
+    if (off > DVD_BLOCK_LEN - 9 ||
+        (AV_RB32(buf + off) & PACKET_START_CODE_MASK) !=
+        PACKET_START_CODE_PREFIX)
+        return -1;
+
+    return off;
+}
+
+/*
+ * Stream id of the sector buf, substream is set to the PRIVATE_STREAM_1
+ * sub stream id (audio or subpicture) or -1.
+ */
+int pack_stream_id(const uint8_t *buf, int *substream)
+{
+    int off = pack_pes_offset(buf);
+    int id;
+
+    if (substream)
+        *substream = -1;
+
+    if (off < 0)
+        return -1;
+
+    id = AV_RB32(buf + off);
+
+    if (id == PRIVATE_STREAM_1 && substream &&
+        off + 9 + buf[off + 8] < DVD_BLOCK_LEN)
+        *substream = buf[off + 9 + buf[off + 8]];
+
+    return id;
+}
+
+/*
+ * Parse the sector buf as NAV pack, it is the sector level counterpart
+ * of find_vobu for streams that are known to be pack aligned.
+ */
+int parse_nav_sector(const uint8_t *buf, VOBU *vobu)
+{
+    int off = pack_pes_offset(buf);
+    const uint8_t *pci, *dsi;
+
+    if (off < 0 ||
+        AV_RB32(buf + off) != PRIVATE_STREAM_2 ||
+        AV_RB16(buf + off + 4) != NAV_PCI_SIZE)
+        return -1;
+
+    pci = buf + off + 6;
+    dsi = pci + NAV_PCI_SIZE;
+
+    if (dsi + 6 + NAV_DSI_SIZE > buf + DVD_BLOCK_LEN ||
+        AV_RB32(dsi) != PRIVATE_STREAM_2 ||
+        AV_RB16(dsi + 4) != NAV_DSI_SIZE)
+        return -1;
+
+    navRead_PCI(&vobu->pci, (uint8_t *)pci + 1);
+    navRead_DSI(&vobu->dsi, (uint8_t *)dsi + 7);
+
+    vobu->vob_id  = vobu->dsi.dsi_gi.vobu_vob_idn;
+    vobu->cell_id = vobu->dsi.dsi_gi.vobu_c_idn;
+
+    return 0;
+}
+
+/*
+ * The PCI and DSI packets of the NAV sector buf, past the substream id.
+ */
+uint8_t *nav_pci(uint8_t *buf)
+{
+    return buf + pack_pes_offset(buf) + 6 + 1;
+}
+
+uint8_t *nav_dsi(uint8_t *buf)
+{
+    return nav_pci(buf) + NAV_PCI_SIZE + 6;
+}
+
+/*
+ * Update the NAV sector buf in place with the sector information, fails
+ * if buf is not a well formed pack.
+ */
+int patch_nav(uint8_t *buf, int32_t lbn, int32_t vobu_ea, int32_t next)
+{
+    uint8_t *pci, *dsi;
+
+    if (pack_pes_offset(buf) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Malformed NAV pack for 0x%08"PRIx32"\n",
+               lbn);
+        return AVERROR_INVALIDDATA;
+    }
+
+    pci = nav_pci(buf);
+    dsi = nav_dsi(buf);
+
+    AV_WB32(pci + PCI_NV_PCK_LBN, lbn);
+    AV_WB32(dsi + DSI_NV_PCK_LBN, lbn);
+    AV_WB32(dsi + DSI_VOBU_EA,    vobu_ea);
+    AV_WB32(dsi + DSI_NEXT_VOBU,  next);
+
+    return 0;
+}
+
+/*
+ * The MPEG-2 pack header SCR in 27MHz units, -1 if buf is not a pack.
+ */
+int64_t pack_scr(const uint8_t *buf)
+{
+    int64_t base;
+
+    if (AV_RB32(buf) != PACK_START_CODE || (buf[4] & 0xc0) != 0x40)
+        return -1;
+
+    base = (int64_t)((buf[4] >> 3) & 7) << 30 |
+           (buf[4] & 3) << 28 | buf[5] << 20 |
+           (buf[6] >> 3) << 15 | (buf[6] & 3) << 13 |
+           buf[7] << 5 | buf[8] >> 3;
+
+    return base * 300 + ((buf[8] & 3) << 7 | buf[9] >> 1);
+}
+
+void set_pack_scr(uint8_t *buf, int64_t scr)
+{
+    int64_t base = scr / 300 & 0x1ffffffffLL;
+    int ext      = scr % 300;
+
+    buf[4] = 0x44 | ((base >> 30) & 7) << 3 | ((base >> 28) & 3);
+    buf[5] = base >> 20;
+    buf[6] = 0x04 | ((base >> 15) & 0x1f) << 3 | ((base >> 13) & 3);
+    buf[7] = base >> 5;
+    buf[8] = 0x04 | (base & 0x1f) << 3 | ((ext >> 7) & 3);
+    buf[9] = (ext & 0x7f) << 1 | 1;
+}
+
+static void shift_ts(uint8_t *p, int64_t offset)
+{
+    int64_t ts = (int64_t)((p[0] >> 1) & 7) << 30 | p[1] << 22 |
+                 (p[2] >> 1) << 15 | p[3] << 7 | p[4] >> 1;
+
+    ts = (ts + offset) & 0x1ffffffffLL;
+
+    p[0] = (p[0] & 0xf0) | ((ts >> 29) & 0x0e) | 1;
+    p[1] = ts >> 22;
+    p[2] = ((ts >> 14) & 0xfe) | 1;
+    p[3] = ts >> 7;
+    p[4] = ((ts << 1) & 0xfe) | 1;
+}
+
+/*
+ * Move the PTS and DTS of the audio, video or PRIVATE_STREAM_1 packet
+ * carried by the sector buf.
+ */
+void shift_pes_ts(uint8_t *buf, int64_t offset)
+{
+    int off = pack_pes_offset(buf);
+    int id;
+
+    if (off < 0)
+        return;
+
+    id = AV_RB32(buf + off);
+
+    if (id != PRIVATE_STREAM_1 && (id < AUDIO_STREAM || id > 0x1ef))
+        return;
+
+    if ((buf[off + 6] & 0xc0) != 0x80)
+        return;
+
+    if (buf[off + 7] & 0x80)
+        shift_ts(buf + off + 9, offset);
+    if ((buf[off + 7] & 0xc0) == 0xc0)
+        shift_ts(buf + off + 14, offset);
+}
+
+/*
+ * Move the presentation times of the NAV sector buf and set the DSI
+ * copy of its SCR.
+ */
+void shift_nav_ptm(uint8_t *buf, int64_t offset)
+{
+    uint8_t *pci = nav_pci(buf);
+    uint8_t *dsi = nav_dsi(buf);
+    int i;
+
+    for (i = PCI_VOBU_S_PTM; i <= PCI_VOBU_SE_E_PTM; i += 4) {
+        uint32_t ptm = AV_RB32(pci + i);
+
+        // A sequence end time of 0 means there is none.
+        if (ptm || i != PCI_VOBU_SE_E_PTM)
+            AV_WB32(pci + i, ptm + offset);
+    }
+
+    AV_WB32(dsi + DSI_NV_PCK_SCR, pack_scr(buf) / 300);
+}
+
+/*
+ * pread and pwrite, retrying on short transfers.
+ */
+int read_at(int fd, uint8_t *buf, int64_t size, int64_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pread(fd, buf, size, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n < 0 ? AVERROR(errno) : AVERROR_EOF;
+
+        buf    += n;
+        size   -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+int write_at(int fd, const uint8_t *buf, int64_t size, int64_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pwrite(fd, buf, size, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n < 0 ? AVERROR(errno) : AVERROR(EIO);
+
+        buf    += n;
+        size   -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+/*
+ * Reserve the final size of an output at once, so it is not fragmented
+ * by the writes growing it.
+ */
+void preallocate(int fd, int64_t size)
+{
+    if (size > 0 && fallocate(fd, 0, 0, size) < 0)
+        av_log(NULL, AV_LOG_VERBOSE, "Cannot preallocate %"PRId64" bytes\n",
+               size);
+}
+
+/*
+ * The input already consumed is not needed again, leave the page cache to
+ * the next stage.
+ */
+void drop_cache(int fd, int64_t offset, int64_t size)
+{
+    posix_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
+}
+
+#define IO_ALIGN        4096
+#define IO_BUFFER_SIZE  (1 << 20)
+#define IO_DROP_SIZE    (8 << 20)
+
+typedef struct FileIO {
+    int fd;
+    int flags;
+    int direct;         ///< the fd is O_DIRECT
+    uint8_t *buf;       ///< IO_ALIGN aligned, writes only
+    int fill;
+    int64_t pos;        ///< of buf in the file
+    int64_t end;        ///< the furthest byte written
+    int64_t reserved;   ///< preallocated
+    int64_t dropped;    ///< the cache is dropped up to there
+} FileIO;
+
+/*
+ * O_DIRECT needs the position, the length and the memory aligned, what
+ * is not goes through the page cache.
+ */
+static int file_io_flush(FileIO *f)
+{
+    int ret;
+
+    if (!f->fill)
+        return 0;
+
+    if (f->direct && (f->pos % IO_ALIGN || f->fill % IO_ALIGN)) {
+        fcntl(f->fd, F_SETFL, fcntl(f->fd, F_GETFL) & ~O_DIRECT);
+        f->direct = 0;
+    }
+
+    if ((ret = write_at(f->fd, f->buf, f->fill, f->pos)) < 0)
+        return ret;
+
+    f->pos += f->fill;
+    f->end  = FFMAX(f->end, f->pos);
+    f->fill = 0;
+
+    return 0;
+}
+
+static int file_io_write(void *opaque, uint8_t *buf, int size)
+{
+    FileIO *f = opaque;
+    int left  = size, ret;
+
+    while (left > 0) {
+        int n = FFMIN(left, IO_BUFFER_SIZE - f->fill);
+
+        memcpy(f->buf + f->fill, buf, n);
+        f->fill += n;
+        buf     += n;
+        left    -= n;
+
+        if (f->fill == IO_BUFFER_SIZE && (ret = file_io_flush(f)) < 0)
+            return ret;
+    }
+
+    return size;
+}
+
+static int file_io_read(void *opaque, uint8_t *buf, int size)
+{
+    FileIO *f = opaque;
+    ssize_t n;
+
+    do {
+        n = read(f->fd, buf, size);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        return AVERROR(errno);
+    if (!n)
+        return AVERROR_EOF;
+
+    f->pos += n;
+
+    if ((f->flags & IO_DONTNEED) && f->pos - f->dropped >= IO_DROP_SIZE) {
+        drop_cache(f->fd, f->dropped, f->pos - f->dropped);
+        f->dropped = f->pos;
+    }
+
+    return n;
+}
+
+static int64_t file_io_seek(void *opaque, int64_t offset, int whence)
+{
+    FileIO *f = opaque;
+    struct stat st;
+    int ret;
+
+    if (whence == AVSEEK_SIZE) {
+        if (fstat(f->fd, &st) < 0)
+            return AVERROR(errno);
+        return FFMAX(st.st_size, f->end);
+    }
+
+    if (f->buf) {
+        if ((ret = file_io_flush(f)) < 0)
+            return ret;
+        if (whence == SEEK_CUR)
+            offset += f->pos;
+        else if (whence == SEEK_END)
+            offset += f->end;
+        f->pos = offset;
+        return offset;
+    }
+
+    if ((f->flags & IO_DONTNEED) && f->pos > f->dropped)
+        drop_cache(f->fd, f->dropped, f->pos - f->dropped);
+
+    if ((offset = lseek(f->fd, offset, whence)) < 0)
+        return AVERROR(errno);
+
+    f->pos = f->dropped = offset;
+
+    return offset;
+}
+
+/*
+ * avio_open for the local files, with IO_DIRECT the writes bypass the
+ * page cache from aligned buffers and size bytes are reserved upfront,
+ * with IO_DONTNEED the input read is dropped from the cache. Without
+ * flags, or for an url, it is avio_open.
+ */
+int open_file_io(AVIOContext **pb, const char *name, int write,
+                 int64_t size, int flags)
+{
+    FileIO *f;
+    uint8_t *buf;
+    int mode = write ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+
+    if (!flags || strchr(name, ':') || !strcmp(name, "-"))
+        return avio_open(pb, name, write ? AVIO_FLAG_WRITE : AVIO_FLAG_READ);
+
+    if (!(f = av_mallocz(sizeof(*f))))
+        return AVERROR(ENOMEM);
+
+    f->flags = flags;
+    f->fd    = -1;
+
+    if (write && (flags & IO_DIRECT)) {
+        f->fd     = open(name, mode | O_DIRECT, 0666);
+        f->direct = f->fd >= 0;
+    }
+
+    // Not every filesystem supports O_DIRECT
+    if (f->fd < 0)
+        f->fd = open(name, mode, 0666);
+
+    if (f->fd < 0) {
+        av_free(f);
+        return AVERROR(errno);
+    }
+
+    if (write) {
+        if (posix_memalign((void **)&f->buf, IO_ALIGN, IO_BUFFER_SIZE)) {
+            close(f->fd);
+            av_free(f);
+            return AVERROR(ENOMEM);
+        }
+        if (flags & IO_DIRECT) {
+            preallocate(f->fd, size);
+            f->reserved = size;
+        }
+    } else if (flags & IO_DONTNEED) {
+        posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    if (!(buf = av_malloc(DVD_BLOCK_LEN * 16)) ||
+        !(*pb = avio_alloc_context(buf, DVD_BLOCK_LEN * 16, write, f,
+                                   write ? NULL : file_io_read,
+                                   write ? file_io_write : NULL,
+                                   file_io_seek))) {
+        av_free(buf);
+        free(f->buf);
+        close(f->fd);
+        av_free(f);
+        return AVERROR(ENOMEM);
+    }
+
+    return 0;
+}
+
+/*
+ * Close a context from open_file_io, trimming the reservation to what
+ * was written.
+ */
+int close_file_io(AVIOContext **pb)
+{
+    FileIO *f;
+    int ret = 0;
+
+    if (!*pb)
+        return 0;
+
+    // The short writes are only recorded in the context.
+    avio_flush(*pb);
+
+    if ((*pb)->seek != file_io_seek) {
+        ret = (*pb)->error;
+        if (avio_closep(pb) < 0 && !ret)
+            ret = AVERROR(EIO);
+        return ret;
+    }
+
+    f = (*pb)->opaque;
+
+    if (f->buf) {
+        if ((ret = file_io_flush(f)) >= 0 && f->reserved > f->end &&
+            ftruncate(f->fd, f->end) < 0)
+            ret = AVERROR(errno);
+        free(f->buf);
+    } else if (f->flags & IO_DONTNEED) {
+        drop_cache(f->fd, f->dropped, 0);
+    }
+
+    if ((*pb)->error < 0)
+        ret = (*pb)->error;
+
+    close(f->fd);
+    av_free(f);
+    av_freep(&(*pb)->buffer);
+    av_freep(pb);
+
+    return ret;
+}
+
+/*
+ * Search intervals of the fwda table in half seconds, bwda has them in
+ * the reverse order.
+ */
+static const int sri_intervals[19] = {
+    240, 120, 60, 20, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+};
+
+static int same_cell(const VOBU *a, const VOBU *b)
+{
+    return a->vob_id == b->vob_id && a->cell_id == b->cell_id;
+}
+
+/*
+ * In 90kHz units, 0 if the end is before the start.
+ */
+int64_t vobu_duration(const VOBU *vobu)
+{
+    int64_t d = (int64_t)vobu->pci.pci_gi.vobu_e_ptm -
+                vobu->pci.pci_gi.vobu_s_ptm;
+
+    return d > 0 ? d : 0;
+}
+
+/*
+ * Regenerate the search information of vobus[i] from the index, the
+ * skip targets are the VOBUs of the same cell presented the given time
+ * after or before it, accumulating the PTS durations so that timestamp
+ * discontinuities do not matter.
+ */
+void build_vobu_sri(VOBU *vobus, int nb_vobus, int i, vobu_sri_t *sri)
+{
+    VOBU *vobu = vobus + i;
+    int64_t acc = 0;
+    int k, j = i;
+
+    for (k = 18; k >= 0; k--) {
+        int64_t t = sri_intervals[k] * 45000LL;
+
+        while (j + 1 < nb_vobus && same_cell(vobu, vobus + j + 1) &&
+               acc + vobu_duration(vobus + j) <= t) {
+            acc += vobu_duration(vobus + j);
+            j++;
+        }
+
+        if (acc + vobu_duration(vobus + j) <= t ||
+            (j == i && (i + 1 >= nb_vobus || !same_cell(vobu, vobus + i + 1))))
+            sri->fwda[k] = SRI_END_OF_CELL;
+        else
+            sri->fwda[k] = SRI_VALID |
+                           (vobus[FFMAX(j, i + 1)].start_sector -
+                            vobu->start_sector);
+    }
+
+    acc = 0;
+    j   = i;
+
+    for (k = 18; k >= 0; k--) {
+        int64_t t = sri_intervals[k] * 45000LL;
+
+        while (j > 0 && same_cell(vobu, vobus + j - 1) && acc < t) {
+            j--;
+            acc += vobu_duration(vobus + j);
+        }
+
+        if (acc < t)
+            sri->bwda[18 - k] = SRI_END_OF_CELL;
+        else
+            sri->bwda[18 - k] = SRI_VALID |
+                                (vobu->start_sector - vobus[j].start_sector);
+    }
+
+    if (i + 1 < nb_vobus && same_cell(vobu, vobus + i + 1))
+        sri->next_video = SRI_VALID |
+                          (vobus[i + 1].start_sector - vobu->start_sector);
+    else
+        sri->next_video = SRI_END_OF_CELL;
+
+    if (i > 0 && same_cell(vobu, vobus + i - 1)) {
+        sri->prev_vobu  = vobu->start_sector - vobus[i - 1].start_sector;
+        sri->prev_video = SRI_VALID | sri->prev_vobu;
+    } else {
+        sri->prev_vobu  = SRI_END_OF_CELL;
+        sri->prev_video = SRI_END_OF_CELL;
+    }
+
+    sri->next_vobu = vobu->next;
+}
+
+void patch_vobu_sri(uint8_t *buf, const vobu_sri_t *sri)
+{
+    uint8_t *p = nav_dsi(buf) + DSI_VOBU_SRI;
+    int i;
+
+    AV_WB32(p, sri->next_video);
+    p += 4;
+    for (i = 0; i < 19; i++, p += 4)
+        AV_WB32(p, sri->fwda[i]);
+    AV_WB32(p, sri->next_vobu);
+    AV_WB32(p + 4, sri->prev_vobu);
+    p += 8;
+    for (i = 0; i < 19; i++, p += 4)
+        AV_WB32(p, sri->bwda[i]);
+    AV_WB32(p, sri->prev_video);
+}
+
+/*
+ * The audio or subpicture stream number carried by a pack, -1 otherwise.
+ */
+int pack_audio_stream(int id, int substream)
+{
+    if ((id & ~7) == AUDIO_STREAM)
+        return id & 7;
+
+    // ac3 0x80, dts 0x88, sdds 0x90, lpcm 0xa0
+    if (id == PRIVATE_STREAM_1 &&
+        ((substream >= 0x80 && substream < 0x98) ||
+         (substream & 0xf8) == 0xa0))
+        return substream & 7;
+
+    return -1;
+}
+
+int pack_subp_stream(int id, int substream)
+{
+    if (id == PRIVATE_STREAM_1 && substream >= 0x20 && substream < 0x40)
+        return substream & 0x1f;
+
+    return -1;
+}
+
+void init_pack_filter(PackFilter *f)
+{
+    int i;
+
+    f->padding = 0;
+
+    for (i = 0; i < 8; i++)
+        f->audio[i] = i;
+    for (i = 0; i < 32; i++)
+        f->subp[i] = i;
+}
+
+/*
+ * Parse a comma separated list of the stream numbers to keep, they are
+ * numbered again from 0 in the list order.
+ */
+int parse_stream_list(int8_t *map, int nb, const char *list)
+{
+    int i, n = 0;
+
+    for (i = 0; i < nb; i++)
+        map[i] = -1;
+
+    while (*list) {
+        char *end;
+        long v = strtol(list, &end, 0);
+
+        if (end == list || v < 0 || v >= nb || map[v] >= 0) {
+            av_log(NULL, AV_LOG_ERROR, "Invalid stream list %s\n", list);
+            return AVERROR(EINVAL);
+        }
+
+        map[v] = n++;
+        list   = *end == ',' ? end + 1 : end;
+    }
+
+    return n;
+}
+
+/*
+ * Drop the packs the filter excludes, NAV sector excluded, from the
+ * VOBU in buf, nb_sectors long. The following packs are moved down
+ * together with the end addresses of the reference pictures, the kept
+ * audio and subpicture packs get their new stream number.
+ * Returns the new number of sectors.
+ */
+int compact_vobu(uint8_t *buf, int nb_sectors, const PackFilter *f)
+{
+    uint8_t *ref_ea = nav_dsi(buf) + DSI_VOBU_1STREF_EA;
+    int32_t ref[3], shift[3] = { 0 };
+    int i, j, n = 1;
+
+    for (j = 0; j < 3; j++)
+        ref[j] = AV_RB32(ref_ea + 4 * j);
+
+    for (i = 1; i < nb_sectors; i++) {
+        uint8_t *sector = buf + i * DVD_BLOCK_LEN;
+        int sub, id = pack_stream_id(sector, &sub);
+        int a = pack_audio_stream(id, sub);
+        int s = pack_subp_stream(id, sub);
+
+        if ((f->padding && id == PADDING_STREAM) ||
+            (a >= 0 && f->audio[a] < 0) ||
+            (s >= 0 && f->subp[s] < 0)) {
+            for (j = 0; j < 3; j++)
+                if (ref[j] > i)
+                    shift[j]++;
+            continue;
+        }
+
+        if (a >= 0 || s >= 0) {
+            int off = pack_pes_offset(sector);
+
+            if (id != PRIVATE_STREAM_1)
+                sector[off + 3] = 0xc0 | f->audio[a];
+            else if (a >= 0)
+                sector[off + 9 + sector[off + 8]] = (sub & ~7) | f->audio[a];
+            else
+                sector[off + 9 + sector[off + 8]] = 0x20 | f->subp[s];
+        }
+
+        if (n != i)
+            memmove(buf + n * DVD_BLOCK_LEN, sector, DVD_BLOCK_LEN);
+        n++;
+    }
+
+    for (j = 0; j < 3; j++)
+        if (ref[j])
+            AV_WB32(ref_ea + 4 * j, ref[j] - shift[j]);
+
+    return n;
+}
+
+/*
+ * Regenerate the sync information of the VOBU in buf, nb_sectors long
+ * with the NAV: the sector offset of the first pack of every audio and
+ * subpicture stream, 0 if the VOBU does not carry it.
+ */
+void build_vobu_synci(const uint8_t *buf, int nb_sectors, synci_t *synci)
+{
+    int i;
+
+    memset(synci, 0, sizeof(*synci));
+
+    for (i = 1; i < nb_sectors; i++) {
+        int sub, id = pack_stream_id(buf + i * DVD_BLOCK_LEN, &sub);
+        int a = pack_audio_stream(id, sub);
+        int s = pack_subp_stream(id, sub);
+
+        if (a >= 0 && !synci->a_synca[a])
+            synci->a_synca[a] = FFMIN(i, 0x3fff);
+        else if (s >= 0 && !synci->sp_synca[s])
+            synci->sp_synca[s] = i;
+    }
+}
+
+void patch_vobu_synci(uint8_t *buf, const synci_t *synci)
+{
+    uint8_t *p = nav_dsi(buf) + DSI_SYNCI;
+    int i;
+
+    for (i = 0; i < 8; i++, p += 2)
+        AV_WB16(p, synci->a_synca[i]);
+    for (i = 0; i < 32; i++, p += 4)
+        AV_WB32(p, synci->sp_synca[i]);
+}
+
+int32_t size_to_sectors(int64_t size)
+{
+    return (size + DVD_BLOCK_LEN - 1) / DVD_BLOCK_LEN;
+}
+
+/*
+ * The IFO is written twice, as IFO and BUP.
+ */
+int32_t title_set_sectors(const TitleSetLayout *ts)
+{
+    return 2 * size_to_sectors(ts->ifo_size) +
+               size_to_sectors(ts->menu_size) +
+               size_to_sectors(ts->title_size);
+}
+
+static int64_t file_size(const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) < 0)
+        return -1;
+
+    return st.st_size;
+}
+
+/*
+ * Gather the size of every file of the VIDEO_TS in path, the title
+ * sets end at the first one without IFO and title. The IFOs not written
+ * yet and the menu VOBs count as empty, the title can be unified or
+ * split in parts. The layout is filled even without VIDEO_TS.IFO, then
+ * AVERROR(ENOENT) is returned since there is no disc to read.
+ */
+int scan_disc_layout(DiscLayout *l, const char *path)
+{
+    char name[1024];
+    int idx, part;
+
+    memset(l, 0, sizeof(*l));
+
+    for (idx = 0; idx <= MAX_TITLE_SETS; idx++) {
+        TitleSetLayout *ts = l->ts + idx;
+
+        if (!idx)
+            snprintf(name, sizeof(name), "%s/VIDEO_TS/VIDEO_TS.IFO", path);
+        else
+            snprintf(name, sizeof(name), "%s/VIDEO_TS/VTS_%02d_0.IFO",
+                     path, idx);
+
+        ts->ifo_size = FFMAX(file_size(name), 0);
+
+        if (!idx)
+            snprintf(name, sizeof(name), "%s/VIDEO_TS/VIDEO_TS.VOB", path);
+        else
+            snprintf(name, sizeof(name), "%s/VIDEO_TS/VTS_%02d_0.VOB",
+                     path, idx);
+
+        ts->menu_size = FFMAX(file_size(name), 0);
+
+        for (part = 1; idx && part <= 9; part++) {
+            int64_t size;
+
+            snprintf(name, sizeof(name), "%s/VIDEO_TS/VTS_%02d_%d.VOB",
+                     path, idx, part);
+
+            if ((size = file_size(name)) < 0)
+                break;
+
+            ts->title_size += size;
+        }
+
+        if (idx && !ts->ifo_size && part == 1) {
+            memset(ts, 0, sizeof(*ts));
+            break;
+        }
+    }
+
+    l->nb_title_sets = idx - 1;
+
+    plan_disc_layout(l);
+
+    if (!l->ts[0].ifo_size)
+        return AVERROR(ENOENT);
+
+    return l->nb_title_sets;
+}
+
+/*
+ * The title is either unified in VTS_xx_1.VOB or split in up to 9 parts,
+ * url is set to read it as a single file.
+ */
+int64_t title_parts(char *url, int size, const char *path, int idx)
+{
+    char title_path[1024];
+    struct stat st;
+    int64_t total = 0;
+    int i;
+
+    snprintf(url, size, "concat:");
+
+    for (i = 1; i <= 9; i++) {
+        snprintf(title_path, sizeof(title_path),
+                 "%s/VIDEO_TS/VTS_%02d_%d.VOB", path, idx, i);
+
+        if (stat(title_path, &st) < 0)
+            break;
+
+        av_strlcatf(url, size, "%s%s", i > 1 ? "|" : "", title_path);
+        total += st.st_size;
+    }
+
+    if (i <= 2)
+        snprintf(url, size, "%s/VIDEO_TS/VTS_%02d_1.VOB", path, idx);
+
+    return total;
+}
+
+/*
+ * Place the title sets one after the other, to be called again once
+ * any size changed.
+ */
+void plan_disc_layout(DiscLayout *l)
+{
+    int32_t sector = 0;
+    int idx;
+
+    for (idx = 0; idx <= l->nb_title_sets; idx++) {
+        l->ts[idx].start_sector = sector;
+        sector += title_set_sectors(l->ts + idx);
+    }
+
+    l->nb_sectors = sector;
+}
+
+int64_t parse_target(const char *target)
+{
+    if (!strcmp(target, "dvd5"))
+        return DVD5_SECTORS;
+    if (!strcmp(target, "dvd9"))
+        return DVD9_SECTORS;
+
+    return strtoll(target, NULL, 0);
+}
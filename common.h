@@ -12,6 +12,8 @@
 #define PRIVATE_STREAM_1   0x1bd
 #define PADDING_STREAM     0x1be
 #define PRIVATE_STREAM_2   0x1bf
+#define AUDIO_STREAM       0x1c0
+#define VIDEO_STREAM       0x1e0
 
 #define DVD_BLOCK_LEN 2048
 
@@ -20,8 +22,37 @@
 
 #define NAV_PACK_SIZE NAV_PCI_SIZE + NAV_DSI_SIZE
 
+// Byte offsets within the PCI and DSI packets, past the substream id.
+#define PCI_NV_PCK_LBN       0x00
+#define PCI_VOBU_S_PTM       0x0c
+#define PCI_VOBU_E_PTM       0x10
+#define PCI_VOBU_SE_E_PTM    0x14
+#define DSI_NV_PCK_SCR       0x00
+#define DSI_NV_PCK_LBN       0x04
+#define DSI_VOBU_EA          0x08
+#define DSI_VOBU_1STREF_EA   0x0c
+#define DSI_VOBU_SRI         0xea
+#define DSI_NEXT_VOBU        0x13a
+#define DSI_SYNCI            0x192
+
+#define SRI_VALID            0x80000000
+
+// A pack at the 10.08Mbit/s DVD mux rate, in 27MHz SCR units.
+#define PACK_SCR_TICKS       43886
+
 #define MAX_SYNC_SIZE 100000
 
+#define DVD5_SECTORS 2295104
+#define DVD9_SECTORS 4171712
+
+#define MAX_TITLE_SETS 99
+
+// The title VOB files are cut a little short of 1GB, as the authoring
+// tools do.
+#define PART_SECTORS 524207
+#define PART_SIZE    ((int64_t)PART_SECTORS * DVD_BLOCK_LEN)
+#define MAX_PARTS    9
+
 #include <dvdread/nav_read.h>
 
 typedef struct {
@@ -41,11 +72,100 @@ typedef struct {
     int32_t last_vobu_start_sector; //FIXME fill this up
 } CELL;
 
+/*
+ * (vob_id, cell_id) -> CELL lookup, the misses are collected to be
+ * reported at once.
+ */
+typedef struct {
+    CELL *cells;
+    int nb_cells;
+    int *slots;         ///< index in cells + 1, 0 if empty
+    int nb_slots;       ///< a power of 2
+    uint32_t *missing;  ///< the keys looked up and not found
+    int nb_missing;
+} CellIndex;
+
+typedef struct {
+    int padding;        ///< drop the padding packs
+    int8_t audio[8];    ///< new number of each audio stream, -1 to drop it
+    int8_t subp[32];    ///< new number of each subpicture stream, -1 to drop it
+} PackFilter;
+
+/*
+ * Sizes in bytes of the files of a title set, the VMG is the title set 0.
+ * start_sector is the one of its IFO, the files follow in the UDF order:
+ * IFO, menu VOB, title VOBs, BUP.
+ */
+typedef struct {
+    int64_t ifo_size;
+    int64_t menu_size;
+    int64_t title_size;
+    int32_t start_sector;
+} TitleSetLayout;
+
+typedef struct {
+    int nb_title_sets;
+    int32_t nb_sectors;
+    TitleSetLayout ts[MAX_TITLE_SETS + 1];
+} DiscLayout;
+
 void parse_nav_pack(AVIOContext *pb, int32_t *header_state, VOBU *vobu);
 int find_vobu(AVIOContext *pb, VOBU *vobus, int i);
 int populate_vobs(VOBU **v, const char *filename);
+int scan_vobs(VOBU **v, const char *filename);
+int walk_vobs(VOBU **v, const char *filename);
+void link_vobus(VOBU *vobus, int nb_vobus);
+int load_vobu_index(VOBU **v, const char *filename);
+int save_vobu_index(const VOBU *vobus, int nb_vobus, const char *filename);
+void drop_vobu_index(const char *filename);
 int populate_cells(CELL **c, VOBU *vobus, int nb_vobus);
+int populate_cell_index(CellIndex *ci, VOBU *vobus, int nb_vobus);
+CELL *find_cell(CellIndex *ci, int vob_id, int cell_id);
+int report_missing_cells(CellIndex *ci, const char *what);
+void free_cell_index(CellIndex *ci);
 
 int find_next_start_code(AVIOContext *pb, int *size_ptr,
                          int32_t *header_state);
+
+int pack_pes_offset(const uint8_t *buf);
+int pack_stream_id(const uint8_t *buf, int *substream);
+int parse_nav_sector(const uint8_t *buf, VOBU *vobu);
+
+int read_at(int fd, uint8_t *buf, int64_t size, int64_t offset);
+int write_at(int fd, const uint8_t *buf, int64_t size, int64_t offset);
+
+#define IO_DIRECT   1   ///< O_DIRECT writes and preallocated outputs
+#define IO_DONTNEED 2   ///< drop the input from the page cache once read
+
+void preallocate(int fd, int64_t size);
+void drop_cache(int fd, int64_t offset, int64_t size);
+int open_file_io(AVIOContext **pb, const char *name, int write,
+                 int64_t size, int flags);
+int close_file_io(AVIOContext **pb);
+
+uint8_t *nav_pci(uint8_t *buf);
+uint8_t *nav_dsi(uint8_t *buf);
+int patch_nav(uint8_t *buf, int32_t lbn, int32_t vobu_ea, int32_t next);
+int64_t pack_scr(const uint8_t *buf);
+void set_pack_scr(uint8_t *buf, int64_t scr);
+void shift_pes_ts(uint8_t *buf, int64_t offset);
+void shift_nav_ptm(uint8_t *buf, int64_t offset);
+
+int64_t vobu_duration(const VOBU *vobu);
+void build_vobu_sri(VOBU *vobus, int nb_vobus, int i, vobu_sri_t *sri);
+void patch_vobu_sri(uint8_t *buf, const vobu_sri_t *sri);
+int pack_audio_stream(int id, int substream);
+int pack_subp_stream(int id, int substream);
+void init_pack_filter(PackFilter *f);
+int parse_stream_list(int8_t *map, int nb, const char *list);
+int compact_vobu(uint8_t *buf, int nb_sectors, const PackFilter *f);
+void build_vobu_synci(const uint8_t *buf, int nb_sectors, synci_t *synci);
+void patch_vobu_synci(uint8_t *buf, const synci_t *synci);
+
+int32_t size_to_sectors(int64_t size);
+int32_t title_set_sectors(const TitleSetLayout *ts);
+int64_t title_parts(char *url, int size, const char *path, int idx);
+int scan_disc_layout(DiscLayout *l, const char *path);
+void plan_disc_layout(DiscLayout *l);
+int64_t parse_target(const char *target);
 #endif // COMMON_H
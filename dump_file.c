@@ -1,5 +1,7 @@
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <dvdread/dvd_reader.h>
@@ -9,39 +11,106 @@
 
 static void help(char *name)
 {
-    fprintf(stderr, "%s <path> [index] [type] [size] [outfile]\n"
+    fprintf(stderr, "%s [-s <start>] [-b <blocks>] <path> [index] [type] [size] [outfile]\n"
             "path: Any path supported by dvdnav, device, iso or directory\n"
             "index: title index, 0 by default\n"
             "type: file type 0=`ifo`, 1=`menu`, 2=`title`, 3=`bup`,"
             "ifo by default\n"
             "size: print up to size sectors, the whole file by default\n"
-            "outfile: write the data to the file",
+            "outfile: write the data to the file, - for stdout\n"
+            "-s: start from this sector, 0 by default\n"
+            "-b: read this many sectors at once, 512 by default\n",
             name);
     exit(0);
 }
 
+#define BLOCK_LEN 2048
+
+// Every byte is printed as "0x00XX "
+#define HEX_LEN   7
+#define HEX_LINE  (1 + 8 * HEX_LEN)
+
+static char hex[256][HEX_LEN];
+
+static void init_hex(void)
+{
+    static const char digits[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        memcpy(hex[i], "0x00", 4);
+        hex[i][4] = digits[i >> 4];
+        hex[i][5] = digits[i & 15];
+        hex[i][6] = ' ';
+    }
+}
+
+/*
+ * A sector is formatted at once and written in a single call, stderr
+ * is not buffered.
+ */
 static void print_blocks(const uint8_t *buf, int count)
 {
+    static char line[BLOCK_LEN / 8 * HEX_LINE + 1];
+    char *p = line;
     int i;
 
     for (i = 0; i < count; i++) {
         if (!(i % 8))
-            fprintf(stderr, "\n");
-        fprintf(stderr, "0x%04x ", buf[i]);
+            *p++ = '\n';
+        memcpy(p, hex[buf[i]], HEX_LEN);
+        p += HEX_LEN;
+    }
+    *p++ = '\n';
+
+    fwrite(line, 1, p - line, stderr);
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+
+        buf  += n;
+        size -= n;
     }
-    fprintf(stderr, "\n");
+
+    return 0;
 }
 
 int main(int argc, char **argv)
 {
     dvd_reader_t *dvd;
     dvd_file_t *file;
-    int i, index = 0, f = -1;
-    int size = 0;
+    uint8_t *buf;
+    int i, c, index = 0, f = -1;
+    int start = 0, size = 0, blocks = 512;
     int domain = DVD_READ_INFO_FILE;
+    char *name = argv[0];
+
+    while ((c = getopt(argc, argv, "s:b:")) != -1) {
+        switch (c) {
+        case 's':
+            start = atoi(optarg);
+            break;
+        case 'b':
+            blocks = atoi(optarg);
+            break;
+        default:
+            help(name);
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
 
-    if (argc < 2)
-        help(argv[0]);
+    if (argc < 2 || start < 0 || blocks < 1)
+        help(name);
     if (argc > 2)
         index = atoi(argv[2]);
     if (argc > 3) {
@@ -65,8 +134,17 @@ int main(int argc, char **argv)
     if (argc > 4)
         size = atoi(argv[4]);
 
-    if (argc > 5)
-        f = open(argv[5], O_CREAT|O_RDWR, 0666);
+    if (argc > 5) {
+        if (!strcmp(argv[5], "-"))
+            f = STDOUT_FILENO;
+        else
+            f = open(argv[5], O_CREAT|O_RDWR, 0666);
+
+        if (f < 0) {
+            fprintf(stderr, "Cannot open %s\n", argv[5]);
+            exit(1);
+        }
+    }
 
     dvd = DVDOpen(argv[1]);
     if(!dvd) {
@@ -75,18 +153,46 @@ int main(int argc, char **argv)
     }
 
     file = DVDOpenFile(dvd, index, domain);
+    if (!file) {
+        fprintf(stderr, "Cannot open the file %d of title %d\n",
+                domain, index);
+        exit(1);
+    }
 
-    if (!size)
-        size = DVDFileSize(file);
+    if (!size || start + size > DVDFileSize(file))
+        size = DVDFileSize(file) - start;
 
-    for (i = 0; i < size; i++) {
-        uint8_t buf[2048];
-        DVDReadBlocks(file, i, 1, buf);
-        if (f > 0)
-            write(f, buf, sizeof(buf));
-        else
-            print_blocks(buf, sizeof(buf));
+    buf = malloc((size_t)blocks * BLOCK_LEN);
+    if (!buf)
+        exit(1);
+
+    init_hex();
+
+    for (i = 0; i < size; i += blocks) {
+        int n = size - i < blocks ? size - i : blocks;
+        int j;
+
+        if (DVDReadBlocks(file, start + i, n, buf) != n) {
+            fprintf(stderr, "Cannot read the sectors %d-%d\n",
+                    start + i, start + i + n - 1);
+            exit(1);
+        }
+
+        if (f >= 0) {
+            if (write_all(f, buf, (size_t)n * BLOCK_LEN) < 0) {
+                fprintf(stderr, "Cannot write the sectors %d-%d\n",
+                        start + i, start + i + n - 1);
+                exit(1);
+            }
+        } else {
+            for (j = 0; j < n; j++)
+                print_blocks(buf + j * BLOCK_LEN, BLOCK_LEN);
+        }
     }
 
+    free(buf);
+    DVDCloseFile(file);
+    DVDClose(dvd);
+
     return 0;
 }
@@ -0,0 +1,415 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <libavformat/avio.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/intreadwrite.h>
+
+#include "common.h"
+
+#define THUMB_SCALE 4
+
+static void help(char *name)
+{
+    fprintf(stderr, "%s <vob> <outpath> [mode] [threads] [columns]\n"
+            "vob: A VOB file.\n"
+            "outpath: output path.\n"
+            "mode: 0 one image per cell, 1 one per vobu, 0 by default\n"
+            "threads: number of decoding threads, 4 by default\n"
+            "columns: write a contact sheet with this many columns instead\n",
+            name);
+    exit(0);
+}
+
+typedef struct THUMB {
+    VOBU *vobu;
+    uint8_t *rgb;
+    int width, height;
+} THUMB;
+
+typedef struct ThumbContext {
+    const char *filename;
+    const char *path;
+    THUMB *thumbs;
+    int nb_thumbs;
+    int next;
+    int columns;
+    int64_t read_sectors;
+    int ret;            ///< the last error of the workers
+    pthread_mutex_t lock;
+} ThumbContext;
+
+/*
+ * Append the video elementary stream carried by the pack to es.
+ */
+static int append_video(uint8_t *es, int es_size, const uint8_t *buf)
+{
+    int off = pack_pes_offset(buf);
+    int len, hdr;
+
+    if (off < 0 || AV_RB32(buf + off) != VIDEO_STREAM)
+        return es_size;
+
+    len = AV_RB16(buf + off + 4) - 3 - buf[off + 8];
+    hdr = off + 9 + buf[off + 8];
+
+    if (len <= 0 || hdr + len > DVD_BLOCK_LEN)
+        return es_size;
+
+    memcpy(es + es_size, buf + hdr, len);
+
+    return es_size + len;
+}
+
+static enum AVCodecID probe_codec(const uint8_t *es, int size)
+{
+    int i;
+
+    for (i = 0; i + 4 <= size; i++)
+        if (AV_RB32(es + i) == 0x000001b3)
+            return AV_CODEC_ID_MPEG2VIDEO;
+
+    return AV_CODEC_ID_H264;
+}
+
+static int decode_picture(const uint8_t *es, int size, AVFrame *frame)
+{
+    enum AVCodecID id          = probe_codec(es, size);
+    AVCodec *codec             = avcodec_find_decoder(id);
+    AVCodecContext *avctx      = avcodec_alloc_context3(codec);
+    AVCodecParserContext *pars = av_parser_init(id);
+    AVPacket pkt;
+    int got = 0, ret = 0;
+
+    if (!avctx || !pars) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    avctx->thread_count = 1;
+
+    if ((ret = avcodec_open2(avctx, codec, NULL)) < 0)
+        goto end;
+
+    av_init_packet(&pkt);
+
+    // Passing an empty buffer at the end flushes the parser.
+    while (!got) {
+        int n = av_parser_parse2(pars, avctx, &pkt.data, &pkt.size,
+                                 es, size,
+                                 AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        es   += n;
+        size -= n;
+
+        if (pkt.size)
+            avcodec_decode_video2(avctx, frame, &got, &pkt);
+        else if (!n)
+            break;
+    }
+
+    if (!got) {
+        pkt.data = NULL;
+        pkt.size = 0;
+        avcodec_decode_video2(avctx, frame, &got, &pkt);
+    }
+
+    if (!got)
+        ret = AVERROR_INVALIDDATA;
+
+end:
+    if (pars)
+        av_parser_close(pars);
+    avcodec_free_context(&avctx);
+
+    return ret;
+}
+
+static uint8_t clip_uint8(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/*
+ * BT.601 limited range to RGB, subsampled by scale.
+ */
+static int frame_to_rgb(THUMB *t, AVFrame *frame, int scale)
+{
+    int x, y;
+
+    if (frame->format != AV_PIX_FMT_YUV420P &&
+        frame->format != AV_PIX_FMT_YUVJ420P)
+        return AVERROR(ENOSYS);
+
+    t->width  = frame->width / scale;
+    t->height = frame->height / scale;
+    t->rgb    = av_malloc(t->width * t->height * 3);
+
+    if (!t->rgb)
+        return AVERROR(ENOMEM);
+
+    for (y = 0; y < t->height; y++) {
+        const uint8_t *ly = frame->data[0] + y * scale * frame->linesize[0];
+        const uint8_t *lu = frame->data[1] + y * scale / 2 * frame->linesize[1];
+        const uint8_t *lv = frame->data[2] + y * scale / 2 * frame->linesize[2];
+        uint8_t *dst      = t->rgb + y * t->width * 3;
+
+        for (x = 0; x < t->width; x++) {
+            int c = 298 * (ly[x * scale] - 16);
+            int d = lu[x * scale / 2] - 128;
+            int e = lv[x * scale / 2] - 128;
+
+            *dst++ = clip_uint8((c + 409 * e + 128) >> 8);
+            *dst++ = clip_uint8((c - 100 * d - 208 * e + 128) >> 8);
+            *dst++ = clip_uint8((c + 516 * d + 128) >> 8);
+        }
+    }
+
+    return 0;
+}
+
+static int write_ppm(const char *name, const uint8_t *rgb, int w, int h)
+{
+    AVIOContext *out = NULL;
+    int ret = avio_open(&out, name, AVIO_FLAG_WRITE);
+
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot write %s.\n", name);
+        return ret;
+    }
+
+    avio_printf(out, "P6\n%d %d\n255\n", w, h);
+    avio_write(out, rgb, w * h * 3);
+    avio_close(out);
+
+    return 0;
+}
+
+/*
+ * Read from the NAV pack up to the end of the first reference picture,
+ * the vobu_ea is used if the 1stref_ea is not set.
+ */
+static int extract_thumb(ThumbContext *ctx, AVIOContext *in,
+                         uint8_t *es, AVFrame *frame, THUMB *t)
+{
+    VOBU *vobu  = t->vobu;
+    int32_t len = vobu->dsi.dsi_gi.vobu_1stref_ea;
+    int i, size = 0, ret;
+    uint8_t buf[DVD_BLOCK_LEN];
+
+    if (!len || len > vobu->end_sector - 1 - vobu->start_sector)
+        len = vobu->end_sector - 1 - vobu->start_sector;
+
+    avio_seek(in, vobu->start, SEEK_SET);
+
+    for (i = 0; i <= len; i++) {
+        if (avio_read(in, buf, sizeof(buf)) != sizeof(buf))
+            break;
+        size = append_video(es, size, buf);
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->read_sectors += i;
+    pthread_mutex_unlock(&ctx->lock);
+
+    memset(es + size, 0, 64);
+
+    if ((ret = decode_picture(es, size, frame)) < 0) {
+        av_log(NULL, AV_LOG_WARNING,
+               "Cannot decode the VOBU at 0x%08"PRIx32"\n",
+               vobu->start_sector);
+        return ret;
+    }
+
+    ret = frame_to_rgb(t, frame, ctx->columns ? THUMB_SCALE : 1);
+    av_frame_unref(frame);
+
+    if (ret < 0 || ctx->columns)
+        return ret;
+
+    {
+        char outname[1024];
+
+        snprintf(outname, sizeof(outname),
+                 "%s/0x%08"PRIx32"-0x%04"PRIx32"-0x%04"PRIx32".ppm",
+                 ctx->path,
+                 vobu->start_sector,
+                 vobu->dsi.dsi_gi.vobu_c_idn,
+                 vobu->dsi.dsi_gi.vobu_vob_idn);
+
+        ret = write_ppm(outname, t->rgb, t->width, t->height);
+        av_freep(&t->rgb);
+    }
+
+    return ret;
+}
+
+static void *thumb_worker(void *arg)
+{
+    ThumbContext *ctx = arg;
+    AVIOContext *in   = NULL;
+    AVFrame *frame    = av_frame_alloc();
+    uint8_t *es       = NULL;
+    int i, max = 0, ret = AVERROR(ENOMEM);
+
+    if (!frame || (ret = avio_open(&in, ctx->filename, AVIO_FLAG_READ)) < 0)
+        goto end;
+
+    for (i = 0; i < ctx->nb_thumbs; i++) {
+        VOBU *vobu = ctx->thumbs[i].vobu;
+        max = FFMAX(max, vobu->end_sector - vobu->start_sector);
+    }
+
+    ret = AVERROR(ENOMEM);
+    if (!(es = av_malloc(max * DVD_BLOCK_LEN + 64)))
+        goto end;
+
+    ret = 0;
+
+    for (;;) {
+        int err;
+
+        pthread_mutex_lock(&ctx->lock);
+        i = ctx->next++;
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (i >= ctx->nb_thumbs)
+            break;
+
+        if ((err = extract_thumb(ctx, in, es, frame, ctx->thumbs + i)) < 0)
+            ret = err;
+    }
+
+end:
+    if (ret < 0) {
+        pthread_mutex_lock(&ctx->lock);
+        ctx->ret = ret;
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    av_free(es);
+    av_frame_free(&frame);
+    if (in)
+        avio_close(in);
+
+    return NULL;
+}
+
+static int write_contact_sheet(ThumbContext *ctx)
+{
+    int i, w = 0, h = 0, rows, ret;
+    uint8_t *sheet;
+    char outname[1024];
+
+    for (i = 0; i < ctx->nb_thumbs; i++) {
+        w = FFMAX(w, ctx->thumbs[i].width);
+        h = FFMAX(h, ctx->thumbs[i].height);
+    }
+
+    rows  = (ctx->nb_thumbs + ctx->columns - 1) / ctx->columns;
+    sheet = av_mallocz(w * ctx->columns * h * rows * 3);
+
+    if (!sheet)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < ctx->nb_thumbs; i++) {
+        THUMB *t = ctx->thumbs + i;
+        int x = i % ctx->columns * w;
+        int y = i / ctx->columns * h;
+        int line;
+
+        for (line = 0; line < t->height; line++)
+            memcpy(sheet + ((y + line) * w * ctx->columns + x) * 3,
+                   t->rgb + line * t->width * 3, t->width * 3);
+    }
+
+    snprintf(outname, sizeof(outname), "%s/contact.ppm", ctx->path);
+
+    ret = write_ppm(outname, sheet, w * ctx->columns, h * rows);
+
+    av_free(sheet);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    ThumbContext ctx = { 0 };
+    VOBU *vobus = NULL;
+    pthread_t *workers;
+    int i, mode = 0, nb_threads = 4, nb_vobus, nb_started = 0;
+
+    av_register_all();
+
+    if (argc < 3)
+        help(argv[0]);
+    if (argc > 3)
+        mode = atoi(argv[3]);
+    if (argc > 4)
+        nb_threads = FFMAX(atoi(argv[4]), 1);
+    if (argc > 5)
+        ctx.columns = atoi(argv[5]);
+
+    ctx.filename = argv[1];
+    ctx.path     = argv[2];
+
+    if ((nb_vobus = walk_vobs(&vobus, argv[1])) <= 0) {
+        av_free(vobus);
+        return 1;
+    }
+
+    ctx.thumbs = av_mallocz(nb_vobus * sizeof(*ctx.thumbs));
+    workers    = av_mallocz(nb_threads * sizeof(*workers));
+
+    if (!ctx.thumbs || !workers)
+        return 1;
+
+    for (i = 0; i < nb_vobus; i++) {
+        if (mode || !i ||
+            vobus[i].vob_id != vobus[i - 1].vob_id ||
+            vobus[i].cell_id != vobus[i - 1].cell_id)
+            ctx.thumbs[ctx.nb_thumbs++].vobu = vobus + i;
+    }
+
+    mkdir(argv[2], 0777);
+
+    pthread_mutex_init(&ctx.lock, NULL);
+
+    for (i = 0; i < nb_threads; i++) {
+        if (pthread_create(workers + i, NULL, thumb_worker, &ctx)) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot start the thread %d\n", i);
+            pthread_mutex_lock(&ctx.lock);
+            ctx.ret = AVERROR(EAGAIN);
+            pthread_mutex_unlock(&ctx.lock);
+            break;
+        }
+        nb_started++;
+    }
+
+    for (i = 0; i < nb_started; i++)
+        pthread_join(workers[i], NULL);
+
+    av_log(NULL, AV_LOG_INFO, "%d images, read %"PRId64" of %"PRId32" sectors\n",
+           ctx.nb_thumbs, ctx.read_sectors + nb_vobus,
+           vobus[nb_vobus - 1].end_sector);
+
+    // The thumbs that failed are left blank
+    if (ctx.columns > 0) {
+        int ret = write_contact_sheet(&ctx);
+        if (ret < 0)
+            ctx.ret = ret;
+    }
+
+    for (i = 0; i < ctx.nb_thumbs; i++)
+        av_free(ctx.thumbs[i].rgb);
+
+    pthread_mutex_destroy(&ctx.lock);
+
+    av_free(workers);
+    av_free(ctx.thumbs);
+    av_free(vobus);
+
+    return ctx.ret < 0;
+}
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <libavformat/avio.h>
 #include <libavformat/avformat.h>
@@ -10,9 +11,10 @@
 
 static void help(char *name)
 {
-    fprintf(stderr, "%s <vob> <outpath>\n"
+    fprintf(stderr, "%s [-D] <vob> <outpath>\n"
             "vob: A VOB file.\n"
-            "outpath: output path.\n",
+            "outpath: output path.\n"
+            "-D: write with direct I/O and drop the vob from the page cache\n",
             name);
     exit(0);
 }
@@ -20,6 +22,7 @@ static void help(char *name)
 AVIOContext *out = NULL;
 AVIOContext *out2 = NULL;
 int vob_idn = -1;
+int io_flags = 0;
 static int write_vob(VOBU *vobu, AVIOContext *in, const char *path)
 {
     char outname[1024];
@@ -34,24 +37,15 @@ static int write_vob(VOBU *vobu, AVIOContext *in, const char *path)
              vobu->dsi.dsi_gi.vobu_vob_idn,
              len ? "_d" : "_e");
 
-    if (!len) {
-        if (out2)
-            avio_close(out2);
-        ret = avio_open(&out2, outname, AVIO_FLAG_WRITE);
-    } else {
-        if (out2)
-            avio_close(out2);
-        out2 = NULL;
-    }
+    close_file_io(&out2);
+    if (!len)
+        ret = open_file_io(&out2, outname, 1, 0, io_flags);
 
     if (vobu->dsi.dsi_gi.vobu_vob_idn != vob_idn) {
         vob_idn = vobu->dsi.dsi_gi.vobu_vob_idn;
-        if (out)
-            avio_close(out);
-        if (out2)
-            avio_close(out2);
-        out2 = NULL;
-        ret = avio_open(&out, outname, AVIO_FLAG_WRITE);
+        close_file_io(&out);
+        close_file_io(&out2);
+        ret = open_file_io(&out, outname, 1, 0, io_flags);
     }
 
     if (ret < 0) {
@@ -86,13 +80,27 @@ int main(int argc, char *argv[])
 {
     AVIOContext *in = NULL;
     VOBU *vobus = NULL;
-    int ret, i = 0, nb_vobus;
+    int ret, i = 0, nb_vobus, c;
+    char *name = argv[0];
     av_register_all();
 
+    while ((c = getopt(argc, argv, "D")) != -1) {
+        switch (c) {
+        case 'D':
+            io_flags = IO_DIRECT | IO_DONTNEED;
+            break;
+        default:
+            help(name);
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc < 3)
-        help(argv[0]);
+        help(name);
 
-    ret = avio_open(&in, argv[1], AVIO_FLAG_READ);
+    ret = open_file_io(&in, argv[1], 0, 0, io_flags);
 
     if (ret < 0) {
         char errbuf[128];
@@ -113,12 +121,12 @@ int main(int argc, char *argv[])
         }
     }
 
-    avio_close(out);
-    avio_close(out2);
+    close_file_io(&out);
+    close_file_io(&out2);
 
     av_free(vobus);
 
-    avio_close(in);
+    close_file_io(&in);
 
     return 0;
 }
@@ -0,0 +1,368 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <dvdread/dvd_reader.h>
+#include <dvdread/ifo_read.h>
+
+#include <libavformat/avio.h>
+#include <libavformat/avformat.h>
+
+#include "common.h"
+
+static void help(char *name)
+{
+    fprintf(stderr, "%s [-j <threads>] [-x] [-D] <path> <outpath>\n"
+            "path:    Any path supported by dvdread, device, iso or directory\n"
+            "outpath: The VIDEO_TS is written there with the titles unified\n"
+            "-j:      extract this many title sets at once, 4 by default\n"
+            "-x:      save the VOBU index of the menus and titles as well\n"
+            "-D:      write the VOBs with direct I/O, preallocated\n",
+            name);
+    exit(0);
+}
+
+// 1MB per read
+#define EXTRACT_BLOCKS 512
+
+typedef struct ExtractContext {
+    const char *src_path, *dst_path;
+    int index;
+    int io_flags;
+    int nb_title_sets;
+    int next;
+    int ret;
+    pthread_mutex_t lock;
+} ExtractContext;
+
+/*
+ * The VOBU index built from the sectors as they are written.
+ */
+typedef struct VOBUIndex {
+    VOBU *vobus;
+    int nb_vobus;
+    int size;
+} VOBUIndex;
+
+static int index_sector(VOBUIndex *x, const uint8_t *buf, int32_t sector)
+{
+    VOBU *v;
+
+    if (x->nb_vobus + 1 >= x->size) {
+        x->size = FFMAX(x->size * 2, 1024);
+        if (av_reallocp_array(&x->vobus, x->size, sizeof(VOBU)) < 0)
+            return AVERROR(ENOMEM);
+    }
+
+    v = x->vobus + x->nb_vobus;
+
+    if (parse_nav_sector(buf, v) || !v->vob_id)
+        return 0;
+
+    v->start_sector = sector;
+    v->start        = (int64_t)sector * DVD_BLOCK_LEN;
+
+    if (x->nb_vobus) {
+        v[-1].end        = v->start;
+        v[-1].end_sector = v->start_sector;
+    }
+
+    x->nb_vobus++;
+
+    return 0;
+}
+
+static int save_index(VOBUIndex *x, const char *name, int32_t nb_sectors)
+{
+    VOBU *last;
+
+    if (!x->nb_vobus)
+        return 0;
+
+    last             = x->vobus + x->nb_vobus - 1;
+    last->end_sector = nb_sectors;
+    last->end        = (int64_t)nb_sectors * DVD_BLOCK_LEN;
+
+    link_vobus(x->vobus, x->nb_vobus);
+
+    memset(x->vobus + x->nb_vobus, 0, sizeof(VOBU));
+    x->vobus[x->nb_vobus].start_sector = -1; // Guard
+
+    return save_vobu_index(x->vobus, x->nb_vobus, name);
+}
+
+static int open_output(const char *name)
+{
+    int fd = open(name, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+
+    if (fd < 0)
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s\n", name);
+
+    return fd;
+}
+
+/*
+ * The IFO and BUP files are not encrypted and read as bytes.
+ */
+static int extract_info(dvd_reader_t *dvd, int idx, int domain,
+                        const char *name)
+{
+    dvd_file_t *file = DVDOpenFile(dvd, idx, domain);
+    uint8_t *buf     = NULL;
+    int64_t size;
+    int fd, ret = 0;
+
+    if (!file) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the source of %s\n", name);
+        return AVERROR(ENOENT);
+    }
+
+    size = (int64_t)DVDFileSize(file) * DVD_BLOCK_LEN;
+
+    if (!(buf = av_malloc(size))) {
+        ret = AVERROR(ENOMEM);
+    } else if (DVDReadBytes(file, buf, size) != size) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot read the source of %s\n", name);
+        ret = AVERROR(EIO);
+    } else if ((fd = open_output(name)) < 0) {
+        ret = AVERROR(errno);
+    } else {
+        ret = write_at(fd, buf, size, 0);
+        close(fd);
+    }
+
+    av_free(buf);
+    DVDCloseFile(file);
+
+    return ret;
+}
+
+/*
+ * Copy a VOB domain in EXTRACT_BLOCKS reads, the title parts come as a
+ * single file. A failing read is retried sector by sector and the
+ * unreadable sectors are zeroed, so the damage stays where it is.
+ */
+static int extract_vobs(dvd_reader_t *dvd, int idx, int domain,
+                        const char *name, int index, int io_flags)
+{
+    dvd_file_t *file = DVDOpenFile(dvd, idx, domain);
+    VOBUIndex x      = { NULL };
+    AVIOContext *out = NULL;
+    uint8_t *buf;
+    int32_t sector, nb_sectors, bad = 0;
+    int ret = 0;
+
+    // Menu VOBs can be omitted
+    if (!file)
+        return 0;
+
+    nb_sectors = DVDFileSize(file);
+
+    if (!(buf = av_malloc(EXTRACT_BLOCKS * DVD_BLOCK_LEN))) {
+        DVDCloseFile(file);
+        return AVERROR(ENOMEM);
+    }
+
+    if ((ret = open_file_io(&out, name, 1, (int64_t)nb_sectors * DVD_BLOCK_LEN,
+                            io_flags)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s\n", name);
+        goto end;
+    }
+
+    for (sector = 0; sector < nb_sectors; sector += EXTRACT_BLOCKS) {
+        int n = FFMIN(EXTRACT_BLOCKS, nb_sectors - sector);
+        int i;
+
+        if (DVDReadBlocks(file, sector, n, buf) != n) {
+            for (i = 0; i < n; i++) {
+                uint8_t *b = buf + i * DVD_BLOCK_LEN;
+
+                if (DVDReadBlocks(file, sector + i, 1, b) != 1) {
+                    memset(b, 0, DVD_BLOCK_LEN);
+                    bad++;
+                }
+            }
+        }
+
+        for (i = 0; index && i < n; i++)
+            if ((ret = index_sector(&x, buf + i * DVD_BLOCK_LEN,
+                                    sector + i)) < 0)
+                goto end;
+
+        avio_write(out, buf, n * DVD_BLOCK_LEN);
+    }
+
+    if (bad)
+        av_log(NULL, AV_LOG_WARNING, "%s: %"PRId32" unreadable sectors zeroed\n",
+               name, bad);
+
+    if ((ret = close_file_io(&out)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot write %s\n", name);
+        goto end;
+    }
+
+    // The index is stamped with the final modification time.
+    if (index)
+        ret = save_index(&x, name, nb_sectors);
+
+end:
+    close_file_io(&out);
+    av_free(x.vobus);
+    av_free(buf);
+    DVDCloseFile(file);
+
+    return ret;
+}
+
+static int extract_title_set(ExtractContext *ctx, int idx)
+{
+    dvd_reader_t *dvd;
+    char name[1024], base[1024];
+    int ret;
+
+    // libdvdread handles are not shared among threads.
+    if (!(dvd = DVDOpen(ctx->src_path))) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the path %s\n", ctx->src_path);
+        return AVERROR(EINVAL);
+    }
+
+    if (idx)
+        snprintf(base, sizeof(base), "%s/VIDEO_TS/VTS_%02d_", ctx->dst_path, idx);
+    else
+        snprintf(base, sizeof(base), "%s/VIDEO_TS/VIDEO_TS.", ctx->dst_path);
+
+    snprintf(name, sizeof(name), idx ? "%s0.IFO" : "%sIFO", base);
+    if ((ret = extract_info(dvd, idx, DVD_READ_INFO_FILE, name)) < 0)
+        goto end;
+
+    snprintf(name, sizeof(name), idx ? "%s0.BUP" : "%sBUP", base);
+    if ((ret = extract_info(dvd, idx, DVD_READ_INFO_BACKUP_FILE, name)) < 0)
+        goto end;
+
+    snprintf(name, sizeof(name), idx ? "%s0.VOB" : "%sVOB", base);
+    if ((ret = extract_vobs(dvd, idx, DVD_READ_MENU_VOBS, name,
+                            ctx->index, ctx->io_flags)) < 0)
+        goto end;
+
+    if (idx) {
+        snprintf(name, sizeof(name), "%s1.VOB", base);
+        ret = extract_vobs(dvd, idx, DVD_READ_TITLE_VOBS, name, ctx->index,
+                           ctx->io_flags);
+    }
+
+end:
+    DVDClose(dvd);
+
+    return ret;
+}
+
+static void *extract_worker(void *arg)
+{
+    ExtractContext *ctx = arg;
+    int idx, ret;
+
+    for (;;) {
+        pthread_mutex_lock(&ctx->lock);
+        idx = ctx->next++;
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (idx > ctx->nb_title_sets)
+            break;
+
+        av_log(NULL, AV_LOG_INFO, "Extracting title set %d\n", idx);
+
+        if ((ret = extract_title_set(ctx, idx)) < 0) {
+            pthread_mutex_lock(&ctx->lock);
+            ctx->ret = ret;
+            pthread_mutex_unlock(&ctx->lock);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    ExtractContext ctx = { NULL };
+    dvd_reader_t *dvd;
+    ifo_handle_t *vmg;
+    pthread_t *workers;
+    char path[1024];
+    int i, c, nb_threads = 4, nb_started = 0;
+    char *name = argv[0];
+
+    av_register_all();
+
+    while ((c = getopt(argc, argv, "j:xD")) != -1) {
+        switch (c) {
+        case 'j':
+            nb_threads = atoi(optarg);
+            break;
+        case 'x':
+            ctx.index = 1;
+            break;
+        case 'D':
+            ctx.io_flags = IO_DIRECT;
+            break;
+        default:
+            help(name);
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < 3)
+        help(name);
+
+    ctx.src_path = argv[1];
+    ctx.dst_path = argv[2];
+
+    dvd = DVDOpen(ctx.src_path);
+    if (!dvd || !(vmg = ifoOpen(dvd, 0))) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the VMG in %s\n",
+               ctx.src_path);
+        return 1;
+    }
+
+    ctx.nb_title_sets = vmg->vmgi_mat->vmg_nr_of_title_sets;
+
+    ifoClose(vmg);
+    DVDClose(dvd);
+
+    mkdir(ctx.dst_path, 0777);
+    snprintf(path, sizeof(path), "%s/VIDEO_TS", ctx.dst_path);
+    mkdir(path, 0777);
+
+    // The VMG is a title set as the others, 0.
+    nb_threads = FFMAX(FFMIN(nb_threads, ctx.nb_title_sets + 1), 1);
+    workers    = av_mallocz(nb_threads * sizeof(*workers));
+    if (!workers)
+        return 1;
+
+    pthread_mutex_init(&ctx.lock, NULL);
+
+    for (i = 0; i < nb_threads; i++) {
+        if (pthread_create(workers + i, NULL, extract_worker, &ctx)) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot start the thread %d\n", i);
+            pthread_mutex_lock(&ctx.lock);
+            ctx.ret = AVERROR(EAGAIN);
+            pthread_mutex_unlock(&ctx.lock);
+            break;
+        }
+        nb_started++;
+    }
+
+    for (i = 0; i < nb_started; i++)
+        pthread_join(workers[i], NULL);
+
+    pthread_mutex_destroy(&ctx.lock);
+    av_free(workers);
+
+    return ctx.ret < 0;
+}
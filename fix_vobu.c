@@ -16,42 +16,50 @@ static void help(char *name)
     exit(0);
 }
 
-static int fix_vob(cell_adr_t *cell_adr_table,
+static int fix_vob(c_adt_t *c_adt,
                    const char *src_path,
                    const char *dst_path)
 {
     VOBU *vobus;
     int nb_vobus;
-    CELL *cells;
-    int nb_cells, i;
+    CellIndex ci;
+    int map_size, i;
 
     if ((nb_vobus = populate_vobs(&vobus, src_path)) < 0)
         return -1;
 
-    if ((nb_cells = populate_cells(&cells, vobus, nb_vobus)) < 0)
+    if (populate_cell_index(&ci, vobus, nb_vobus) < 0)
         return -1;
 
-    for (i = 0; i < nb_cells; i++) {
-         av_log(NULL, AV_LOG_INFO|AV_LOG_C(128),
-                "vob_id %02d, cell_id %02d, off 0x%08x",
-                cell_adr_table[i].vob_id,
-                cell_adr_table[i].cell_id,
-                cell_adr_table[i].start_sector);
+    map_size = (c_adt->last_byte + 1 - C_ADT_SIZE) / sizeof(cell_adr_t);
+
+    for (i = 0; i < map_size; i++) {
+        cell_adr_t *adr = c_adt->cell_adr_table + i;
+        CELL *cell      = find_cell(&ci, adr->vob_id, adr->cell_id);
+
+        if (!cell)
+            continue;
+
+        av_log(NULL, AV_LOG_INFO|AV_LOG_C(128),
+               "vob_id %02d, cell_id %02d, off 0x%08x",
+               adr->vob_id, adr->cell_id, adr->start_sector);
 
         av_log(NULL, AV_LOG_INFO, " -> ");
 
         av_log(NULL, AV_LOG_INFO|AV_LOG_C(111),
-                "vob_id %02d, cell_id %02d, off 0x%08x",
-                cells[i].vob_id,
-                cells[i].cell_id,
-                cells[i].start_sector);
-        if (cell_adr_table[i].vob_id != cells[i].vob_id ||
-            cell_adr_table[i].cell_id != cells[i].cell_id)
+               "off 0x%08x", cell->start_sector);
+        if (adr->start_sector != cell->start_sector ||
+            adr->last_sector != cell->last_sector)
             av_log(NULL, AV_LOG_INFO|AV_LOG_C(222),
                    " X ");
         av_log(NULL, AV_LOG_INFO, "\n");
     }
 
+    report_missing_cells(&ci, src_path);
+
+    free_cell_index(&ci);
+    av_free(vobus);
+
     return 0;
 }
 
@@ -69,7 +77,7 @@ static int fix_title_vob(ifo_handle_t *ifo,
     snprintf(dst, sizeof(dst), "%s/VIDEO_TS/VTS_%02d_1.VOB",
              dst_path, idx);
 
-    return fix_vob(ifo->vts_c_adt->cell_adr_table, src, dst);
+    return fix_vob(ifo->vts_c_adt, src, dst);
 }
 
 static int fix_menu_vob(ifo_handle_t *ifo,
@@ -94,7 +102,7 @@ static int fix_menu_vob(ifo_handle_t *ifo,
                  dst_path);
     }
 
-    return fix_vob(ifo->menu_c_adt->cell_adr_table, src, dst);
+    return fix_vob(ifo->menu_c_adt, src, dst);
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,518 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <dvdread/dvd_reader.h>
+#include <dvdread/ifo_read.h>
+
+#include <libavformat/avio.h>
+#include <libavformat/avformat.h>
+
+#include "common.h"
+
+static void help(char *name)
+{
+    fprintf(stderr, "%s [-T <title>] [-c <first>[-<last>]] "
+            "[-t <start>[-<end>]] <path> <out>\n"
+            "path: The path to a dvd-video file layout, unencrypted\n"
+            "out:  The clip VOB, its index is saved in out.idx\n"
+            "-T:   the title, 1 by default\n"
+            "-c:   the chapters, all by default\n"
+            "-t:   the time range in seconds within the chapters,\n"
+            "      extended to the enclosing VOBUs\n",
+            name);
+    exit(0);
+}
+
+typedef struct ClipContext {
+    VOBU *vobus;        ///< of the cells played, in playback order
+    int nb_vobus;
+    int *sel;           ///< the VOBUs of the clip, in playback order
+    int nb_sel;
+    int64_t start, end; ///< in 90kHz units, end < 0 for the whole range
+    int64_t elapsed;
+} ClipContext;
+
+/*
+ * The title parts as a single file for copy_file_range.
+ */
+typedef struct TitleParts {
+    int fd[MAX_PARTS];
+    int64_t size[MAX_PARTS];
+    int nb_parts;
+} TitleParts;
+
+static int parse_range(const char *s, double *first, double *last)
+{
+    char *end;
+
+    *first = strtod(s, &end);
+    *last  = -1;
+
+    if (end == s || *first < 0)
+        return AVERROR(EINVAL);
+
+    if (*end == '-') {
+        s     = end + 1;
+        *last = strtod(s, &end);
+        if (end == s || *last < *first)
+            return AVERROR(EINVAL);
+    }
+
+    return *end ? AVERROR(EINVAL) : 0;
+}
+
+static int open_title_parts(TitleParts *t, const char *path, int idx)
+{
+    char name[1024];
+    struct stat st;
+    int i;
+
+    for (i = 0; i < MAX_PARTS; i++) {
+        snprintf(name, sizeof(name), "%s/VIDEO_TS/VTS_%02d_%d.VOB",
+                 path, idx, i + 1);
+
+        if ((t->fd[i] = open(name, O_RDONLY)) < 0)
+            break;
+
+        fstat(t->fd[i], &st);
+        t->size[i] = st.st_size;
+        t->nb_parts++;
+    }
+
+    if (!t->nb_parts) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s\n", name);
+        return AVERROR(ENOENT);
+    }
+
+    return 0;
+}
+
+static void close_title_parts(TitleParts *t)
+{
+    int i;
+
+    for (i = 0; i < t->nb_parts; i++)
+        close(t->fd[i]);
+}
+
+static int read_title(TitleParts *t, uint8_t *buf, int64_t size,
+                      int64_t offset)
+{
+    int i, ret;
+
+    for (i = 0; i < t->nb_parts && size > 0; i++) {
+        int64_t n;
+
+        if (offset >= t->size[i]) {
+            offset -= t->size[i];
+            continue;
+        }
+
+        n = FFMIN(size, t->size[i] - offset);
+
+        if ((ret = read_at(t->fd[i], buf, n, offset)) < 0)
+            return ret;
+
+        buf   += n;
+        size  -= n;
+        offset = 0;
+    }
+
+    return size ? AVERROR_EOF : 0;
+}
+
+/*
+ * Index the VOBUs of the cell reading only their NAV sectors, following
+ * vobu_ea and scanning sector by sector from the last good NAV pack when
+ * a jump does not land on one. The cell ends the last VOBU.
+ */
+static int index_cell(ClipContext *c, TitleParts *t, cell_playback_t *cp)
+{
+    uint8_t buf[DVD_BLOCK_LEN];
+    uint32_t sector = cp->first_sector, last = sector;
+    int first = c->nb_vobus, jumped = 0, ret;
+
+    while (sector <= cp->last_sector) {
+        VOBU v = { 0 };
+
+        if ((ret = read_title(t, buf, DVD_BLOCK_LEN,
+                              (int64_t)sector * DVD_BLOCK_LEN)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot read the sector 0x%08"PRIx32"\n",
+                   sector);
+            return ret;
+        }
+
+        if (parse_nav_sector(buf, &v) || !v.vob_id) {
+            if (jumped) {
+                av_log(NULL, AV_LOG_VERBOSE,
+                       "No NAV at 0x%08"PRIx32", rescanning from 0x%08"PRIx32"\n",
+                       sector, last);
+                sector = last;
+                jumped = 0;
+            }
+            sector++;
+            continue;
+        }
+
+        v.start_sector = sector;
+        v.start        = (int64_t)sector * DVD_BLOCK_LEN;
+
+        if (c->nb_vobus > first) {
+            c->vobus[c->nb_vobus - 1].end_sector = sector;
+            c->vobus[c->nb_vobus - 1].end        = v.start;
+        }
+
+        if (av_reallocp_array(&c->vobus, c->nb_vobus + 1,
+                              sizeof(*c->vobus)) < 0)
+            return AVERROR(ENOMEM);
+
+        c->vobus[c->nb_vobus++] = v;
+
+        last = sector;
+
+        // A jump out of the cell is as wrong as one landing off a NAV pack
+        if (v.dsi.dsi_gi.vobu_ea > cp->last_sector - sector) {
+            sector++;
+            jumped = 0;
+        } else {
+            sector = sector + 1 + v.dsi.dsi_gi.vobu_ea;
+            jumped = 1;
+        }
+    }
+
+    if (c->nb_vobus == first) {
+        av_log(NULL, AV_LOG_ERROR, "No NAV in the cell at 0x%08"PRIx32"\n",
+               cp->first_sector);
+        return AVERROR_INVALIDDATA;
+    }
+
+    c->vobus[c->nb_vobus - 1].end_sector = cp->last_sector + 1;
+    c->vobus[c->nb_vobus - 1].end        = (int64_t)(cp->last_sector + 1) *
+                                           DVD_BLOCK_LEN;
+
+    return first;
+}
+
+/*
+ * Select the VOBUs of a cell presented within the time range, the ones
+ * of the other angles interleaved with it are skipped.
+ */
+static int select_cell(ClipContext *c, TitleParts *t, cell_playback_t *cp,
+                       cell_position_t *pos)
+{
+    int j;
+
+    if ((j = index_cell(c, t, cp)) < 0)
+        return j;
+
+    for (; j < c->nb_vobus; j++) {
+        VOBU *v   = c->vobus + j;
+        int64_t d = (int64_t)v->pci.pci_gi.vobu_e_ptm -
+                    v->pci.pci_gi.vobu_s_ptm;
+        int64_t t = c->elapsed;
+
+        if (v->vob_id != pos->vob_id_nr || v->cell_id != pos->cell_nr)
+            continue;
+
+        c->elapsed += FFMAX(d, 0);
+
+        if (c->elapsed <= c->start || (c->end >= 0 && t >= c->end))
+            continue;
+
+        if (av_reallocp_array(&c->sel, c->nb_sel + 1, sizeof(*c->sel)) < 0)
+            return AVERROR(ENOMEM);
+
+        c->sel[c->nb_sel++] = j;
+    }
+
+    return 0;
+}
+
+/*
+ * A chapter is a program, it runs from its entry cell to the entry cell
+ * of the next program of its PGC.
+ */
+static int select_chapter(ClipContext *c, TitleParts *t, ifo_handle_t *ifo,
+                          ptt_info_t *ptt)
+{
+    pgc_t *pgc;
+    int i, first, last, ret;
+
+    if (!ptt->pgcn || ptt->pgcn > ifo->vts_pgcit->nr_of_pgci_srp)
+        return AVERROR_INVALIDDATA;
+
+    pgc = ifo->vts_pgcit->pgci_srp[ptt->pgcn - 1].pgc;
+
+    if (!pgc || !pgc->cell_playback || !ptt->pgn ||
+        ptt->pgn > pgc->nr_of_programs)
+        return AVERROR_INVALIDDATA;
+
+    first = pgc->program_map[ptt->pgn - 1];
+    last  = ptt->pgn < pgc->nr_of_programs ? pgc->program_map[ptt->pgn] - 1
+                                           : pgc->nr_of_cells;
+
+    for (i = first; i <= last && i <= pgc->nr_of_cells; i++) {
+        cell_playback_t *cp = pgc->cell_playback + i - 1;
+
+        // The first angle stands for the block
+        if (cp->block_type == BLOCK_TYPE_ANGLE_BLOCK &&
+            cp->block_mode != BLOCK_MODE_FIRST_CELL)
+            continue;
+
+        if ((ret = select_cell(c, t, cp, pgc->cell_position + i - 1)) < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Copy in the kernel where possible, reading and writing otherwise.
+ */
+static int copy_range(int in, int64_t in_off, int out, int64_t out_off,
+                      int64_t size)
+{
+    uint8_t buf[64 * DVD_BLOCK_LEN];
+    int ret;
+
+    while (size > 0) {
+        loff_t off_in  = in_off;
+        loff_t off_out = out_off;
+        ssize_t n      = copy_file_range(in, &off_in, out, &off_out, size, 0);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            n = FFMIN(size, sizeof(buf));
+            if ((ret = read_at(in, buf, n, in_off)) < 0 ||
+                (ret = write_at(out, buf, n, out_off)) < 0)
+                return ret;
+        }
+
+        in_off  += n;
+        out_off += n;
+        size    -= n;
+    }
+
+    return 0;
+}
+
+static int copy_title_range(TitleParts *t, int64_t offset, int out,
+                            int64_t out_off, int64_t size)
+{
+    int i, ret;
+
+    for (i = 0; i < t->nb_parts && size > 0; i++) {
+        int64_t n;
+
+        if (offset >= t->size[i]) {
+            offset -= t->size[i];
+            continue;
+        }
+
+        n = FFMIN(size, t->size[i] - offset);
+
+        if ((ret = copy_range(t->fd[i], offset, out, out_off, n)) < 0)
+            return ret;
+
+        out_off += n;
+        size    -= n;
+        offset   = 0;
+    }
+
+    return size ? AVERROR_EOF : 0;
+}
+
+/*
+ * Lay the selected VOBUs one after the other, copying each contiguous
+ * run at once, then patch the NAV packets for their new sectors.
+ */
+static int write_clip(ClipContext *c, TitleParts *t, const char *name)
+{
+    VOBU *clip;
+    uint8_t nav[DVD_BLOCK_LEN];
+    int64_t pos = 0;
+    int i, j, out, ret = 0;
+
+    if (!(clip = av_mallocz((c->nb_sel + 1) * sizeof(*clip))))
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < c->nb_sel; i++) {
+        VOBU *v = clip + i;
+
+        *v              = c->vobus[c->sel[i]];
+        v->start        = pos;
+        v->end          = pos + c->vobus[c->sel[i]].end -
+                          c->vobus[c->sel[i]].start;
+        v->start_sector = v->start / DVD_BLOCK_LEN;
+        v->end_sector   = v->end / DVD_BLOCK_LEN;
+        pos             = v->end;
+    }
+
+    link_vobus(clip, c->nb_sel);
+    clip[c->nb_sel].start_sector = -1; // Guard
+
+    if ((out = open(name, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s\n", name);
+        av_free(clip);
+        return AVERROR(errno);
+    }
+
+    preallocate(out, pos);
+
+    for (i = 0; i < c->nb_sel; i = j) {
+        VOBU *v = c->vobus + c->sel[i];
+
+        for (j = i + 1; j < c->nb_sel &&
+             c->vobus[c->sel[j]].start == c->vobus[c->sel[j - 1]].end; j++);
+
+        if ((ret = copy_title_range(t, v->start, out, clip[i].start,
+                                    c->vobus[c->sel[j - 1]].end -
+                                    v->start)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot copy the sectors from %"PRId32"\n",
+                   v->start_sector);
+            goto end;
+        }
+    }
+
+    for (i = 0; i < c->nb_sel; i++) {
+        VOBU *v = clip + i;
+        vobu_sri_t sri;
+
+        if ((ret = read_at(out, nav, DVD_BLOCK_LEN, v->start)) < 0)
+            goto end;
+
+        if ((ret = patch_nav(nav, v->start_sector,
+                             v->end_sector - 1 - v->start_sector, v->next)) < 0)
+            goto end;
+        build_vobu_sri(clip, c->nb_sel, i, &sri);
+        patch_vobu_sri(nav, &sri);
+
+        if ((ret = write_at(out, nav, DVD_BLOCK_LEN, v->start)) < 0)
+            goto end;
+
+        // The saved index has the NAV as written
+        parse_nav_sector(nav, v);
+    }
+
+end:
+    close(out);
+
+    if (ret >= 0)
+        ret = save_vobu_index(clip, c->nb_sel, name);
+
+    av_log(NULL, ret < 0 ? AV_LOG_ERROR : AV_LOG_INFO,
+           "%s: %d VOBUs, %"PRId64" sectors\n",
+           name, c->nb_sel, pos / DVD_BLOCK_LEN);
+
+    av_free(clip);
+
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    ClipContext c = { NULL };
+    TitleParts parts = { { 0 } };
+    dvd_reader_t *dvd;
+    ifo_handle_t *vmg, *ifo;
+    title_info_t *title;
+    double first_ch = 1, last_ch = -1, start = 0, end = -1;
+    char *name = argv[0];
+    int opt, ttn = 1, chapters = 0, i, ret = 1;
+    ttu_t *ttu;
+
+    av_register_all();
+
+    while ((opt = getopt(argc, argv, "T:c:t:")) != -1) {
+        switch (opt) {
+        case 'T':
+            ttn = atoi(optarg);
+            break;
+        case 'c':
+            if (parse_range(optarg, &first_ch, &last_ch) < 0 || first_ch < 1)
+                help(name);
+            chapters = 1;
+            break;
+        case 't':
+            if (parse_range(optarg, &start, &end) < 0)
+                help(name);
+            break;
+        default:
+            help(name);
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < 3)
+        help(name);
+
+    c.start = start * 90000;
+    c.end   = end < 0 ? -1 : end * 90000;
+
+    dvd = DVDOpen(argv[1]);
+    if (!dvd || !(vmg = ifoOpen(dvd, 0))) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the VMG in %s\n", argv[1]);
+        return 1;
+    }
+
+    if (ttn < 1 || ttn > vmg->tt_srpt->nr_of_srpts) {
+        av_log(NULL, AV_LOG_ERROR, "No title %d\n", ttn);
+        return 1;
+    }
+
+    title = vmg->tt_srpt->title + ttn - 1;
+
+    if (!(ifo = ifoOpen(dvd, title->title_set_nr))) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the title set %d\n",
+               title->title_set_nr);
+        return 1;
+    }
+
+    if (open_title_parts(&parts, argv[1], title->title_set_nr) < 0)
+        goto end;
+
+    if (!title->vts_ttn ||
+        title->vts_ttn > ifo->vts_ptt_srpt->nr_of_srpts) {
+        av_log(NULL, AV_LOG_ERROR, "No title %d in the title set\n",
+               title->vts_ttn);
+        goto end;
+    }
+
+    ttu = ifo->vts_ptt_srpt->title + title->vts_ttn - 1;
+
+    // A single chapter if only the first is given
+    if (last_ch < 0)
+        last_ch = chapters ? first_ch : ttu->nr_of_ptts;
+
+    for (i = first_ch; i <= last_ch && i <= ttu->nr_of_ptts; i++)
+        if (select_chapter(&c, &parts, ifo, ttu->ptt + i - 1) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Chapter %d is not valid\n", i);
+            goto end;
+        }
+
+    if (!c.nb_sel) {
+        av_log(NULL, AV_LOG_ERROR, "Nothing in the range\n");
+        goto end;
+    }
+
+    ret = write_clip(&c, &parts, argv[2]) < 0;
+
+end:
+    close_title_parts(&parts);
+    av_free(c.sel);
+    av_free(c.vobus);
+    ifoClose(ifo);
+    ifoClose(vmg);
+    DVDClose(dvd);
+
+    return ret;
+}
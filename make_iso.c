@@ -0,0 +1,887 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <libavformat/avio.h>
+#include <libavformat/avformat.h>
+#include <libavutil/intreadwrite.h>
+
+#include "common.h"
+
+static void help(char *name)
+{
+    fprintf(stderr, "%s <path> <iso> [label]\n"
+            "path:  The path to a dvd-video file layout, the titles can be\n"
+            "       unified, the BUPs missing\n"
+            "iso:   The UDF 1.02/ISO9660 image to write, - for stdout\n"
+            "label: The volume label, DVD_VIDEO by default\n",
+            name);
+    exit(0);
+}
+
+/*
+ * The image is laid out as the DVD-Video authoring tools do:
+ *
+ *  16-20   ISO9660 primary and terminator, UDF volume recognition
+ *  21-22   ISO9660 path tables
+ *  32-37   UDF main volume descriptor sequence
+ *  48-53   UDF reserve volume descriptor sequence
+ *  64-65   UDF logical volume integrity sequence
+ *  66-     ISO9660 directories
+ *  256     UDF anchor
+ *  257-    UDF partition: file set, directories, file entries, then the
+ *          files in the disc layout order
+ *  last    UDF anchor
+ */
+#define ISO_PVD_SECTOR      16
+#define ISO_PATH_L_SECTOR   21
+#define ISO_PATH_M_SECTOR   22
+#define UDF_MAIN_VDS        32
+#define UDF_RESERVE_VDS     48
+#define UDF_LVID_SECTOR     64
+#define ISO_DIR_SECTOR      66
+#define UDF_ANCHOR_SECTOR   256
+#define UDF_PARTITION_START 257
+
+#define TAG_PVD   1
+#define TAG_AVDP  2
+#define TAG_IUVD  4
+#define TAG_PD    5
+#define TAG_LVD   6
+#define TAG_USD   7
+#define TAG_TD    8
+#define TAG_LVID  9
+#define TAG_FSD   256
+#define TAG_FID   257
+#define TAG_FE    261
+
+#define COPY_BLOCKS 512
+
+typedef struct IsoFile {
+    char name[16];
+    int idx;
+    int type;           ///< 0 ifo, 1 menu, 2 title part, 3 bup
+    int part;
+    int64_t size;
+    int32_t sector;     ///< absolute
+    int32_t fe_lbn;     ///< UDF file entry, in the partition
+} IsoFile;
+
+typedef struct IsoContext {
+    const char *path;
+    char label[33];
+    DiscLayout layout;
+    IsoFile *files;
+    int nb_files;
+    uint8_t *meta;      ///< every sector before the first file
+    int32_t data_sector;
+    int32_t end_sector; ///< the closing anchor
+    int32_t vts_dir_lbn, vts_dir_blocks, vts_dir_bytes;
+    int32_t iso_vts_dir_sectors;
+    struct tm tm;
+    uint16_t crc_table[256];
+} IsoContext;
+
+static void init_crc(IsoContext *ctx)
+{
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        uint16_t crc = i << 8;
+
+        for (j = 0; j < 8; j++)
+            crc = crc & 0x8000 ? crc << 1 ^ 0x1021 : crc << 1;
+
+        ctx->crc_table[i] = crc;
+    }
+}
+
+static uint16_t udf_crc(IsoContext *ctx, const uint8_t *buf, int len)
+{
+    uint16_t crc = 0;
+
+    while (len--)
+        crc = crc << 8 ^ ctx->crc_table[(crc >> 8 ^ *buf++) & 0xff];
+
+    return crc;
+}
+
+static uint8_t *sector_at(IsoContext *ctx, int32_t sector)
+{
+    return ctx->meta + (int64_t)sector * DVD_BLOCK_LEN;
+}
+
+/*
+ * The tag goes last, once the descriptor of len bytes is filled.
+ */
+static void udf_tag(IsoContext *ctx, uint8_t *buf, int id, int32_t location,
+                    int len)
+{
+    int i, sum = 0;
+
+    AV_WL16(buf,      id);
+    AV_WL16(buf + 2,  2);
+    AV_WL16(buf + 6,  0);
+    AV_WL16(buf + 8,  udf_crc(ctx, buf + 16, len - 16));
+    AV_WL16(buf + 10, len - 16);
+    AV_WL32(buf + 12, location);
+
+    for (i = 0; i < 16; i++)
+        if (i != 4)
+            sum += buf[i];
+    buf[4] = sum;
+}
+
+static void udf_dstring(uint8_t *buf, int size, const char *s)
+{
+    int len = FFMIN(strlen(s), size - 2);
+
+    memset(buf, 0, size);
+    if (!len)
+        return;
+
+    buf[0] = 8;
+    memcpy(buf + 1, s, len);
+    buf[size - 1] = len + 1;
+}
+
+static void udf_charspec(uint8_t *buf)
+{
+    memset(buf, 0, 64);
+    memcpy(buf + 1, "OSTA Compressed Unicode", 23);
+}
+
+static void udf_regid(uint8_t *buf, const char *id, int udf_suffix)
+{
+    memset(buf, 0, 32);
+    memcpy(buf + 1, id, strlen(id));
+    if (udf_suffix)
+        AV_WL16(buf + 24, 0x0102);
+}
+
+static void udf_timestamp(IsoContext *ctx, uint8_t *buf)
+{
+    AV_WL16(buf,     0x1000);
+    AV_WL16(buf + 2, ctx->tm.tm_year + 1900);
+    buf[4] = ctx->tm.tm_mon + 1;
+    buf[5] = ctx->tm.tm_mday;
+    buf[6] = ctx->tm.tm_hour;
+    buf[7] = ctx->tm.tm_min;
+    buf[8] = ctx->tm.tm_sec;
+    memset(buf + 9, 0, 3);
+}
+
+static void udf_long_ad(uint8_t *buf, uint32_t len, uint32_t lbn)
+{
+    memset(buf, 0, 16);
+    AV_WL32(buf,     len);
+    AV_WL32(buf + 4, lbn);
+}
+
+static void iso_both16(uint8_t *buf, uint16_t v)
+{
+    AV_WL16(buf, v);
+    AV_WB16(buf + 2, v);
+}
+
+static void iso_both32(uint8_t *buf, uint32_t v)
+{
+    AV_WL32(buf, v);
+    AV_WB32(buf + 4, v);
+}
+
+static void iso_string(uint8_t *buf, int size, const char *s)
+{
+    memset(buf, ' ', size);
+    memcpy(buf, s, FFMIN(strlen(s), size));
+}
+
+/*
+ * Collect the files in the order they are laid out, the title parts are
+ * cut from the title as make_vob -S does.
+ */
+static int collect_files(IsoContext *ctx)
+{
+    DiscLayout *l = &ctx->layout;
+    int idx, t, p;
+
+    ctx->files = av_mallocz((l->nb_title_sets + 1) * (3 + MAX_PARTS) *
+                            sizeof(*ctx->files));
+    if (!ctx->files)
+        return AVERROR(ENOMEM);
+
+    for (idx = 0; idx <= l->nb_title_sets; idx++) {
+        TitleSetLayout *ts = l->ts + idx;
+        int nb_parts       = (ts->title_size + PART_SIZE - 1) / PART_SIZE;
+
+        if (!ts->ifo_size) {
+            av_log(NULL, AV_LOG_ERROR, "The IFO of title set %d is missing\n",
+                   idx);
+            return AVERROR(ENOENT);
+        }
+
+        if (nb_parts > MAX_PARTS) {
+            av_log(NULL, AV_LOG_ERROR, "The title %d does not fit %d parts\n",
+                   idx, MAX_PARTS);
+            return AVERROR(EINVAL);
+        }
+
+        for (t = 0; t < 4; t++) {
+            for (p = 1; p <= (t == 2 ? nb_parts : 1); p++) {
+                IsoFile *f = ctx->files + ctx->nb_files;
+                static const char *ext[] = { "IFO", "VOB", "VOB", "BUP" };
+
+                if (t == 1 && !ts->menu_size)
+                    continue;
+
+                f->idx  = idx;
+                f->type = t;
+                f->part = p;
+
+                if (idx)
+                    snprintf(f->name, sizeof(f->name), "VTS_%02d_%d.%s",
+                             idx, t == 2 ? p : 0, ext[t]);
+                else
+                    snprintf(f->name, sizeof(f->name), "VIDEO_TS.%s", ext[t]);
+
+                switch (t) {
+                case 0:
+                case 3: f->size = ts->ifo_size;  break;
+                case 1: f->size = ts->menu_size; break;
+                case 2: f->size = FFMIN(ts->title_size - (p - 1) * PART_SIZE,
+                                        PART_SIZE);
+                        break;
+                }
+
+                ctx->nb_files++;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int fid_size(const char *name)
+{
+    return (38 + (*name ? 1 + strlen(name) : 0) + 3) & ~3;
+}
+
+static int iso_record_size(const char *name)
+{
+    return (33 + strlen(name) + 1) & ~1;
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+    return strcmp((*(IsoFile * const *)a)->name, (*(IsoFile * const *)b)->name);
+}
+
+/*
+ * Place the metadata and the files, the file sectors follow the disc
+ * layout so the IFOs written by rewrite_ifo stay valid.
+ */
+static void plan_image(IsoContext *ctx)
+{
+    int32_t lbn, sector, used;
+    int i;
+
+    ctx->vts_dir_bytes = fid_size("");
+    for (i = 0; i < ctx->nb_files; i++)
+        ctx->vts_dir_bytes += fid_size(ctx->files[i].name);
+
+    ctx->vts_dir_lbn    = 7;
+    ctx->vts_dir_blocks = size_to_sectors(ctx->vts_dir_bytes);
+
+    lbn = ctx->vts_dir_lbn + ctx->vts_dir_blocks;
+    for (i = 0; i < ctx->nb_files; i++)
+        ctx->files[i].fe_lbn = lbn++;
+
+    ctx->data_sector = UDF_PARTITION_START + lbn;
+
+    // The records do not cross the sector boundaries.
+    ctx->iso_vts_dir_sectors = 1;
+    used = 2 * 34;
+    for (i = 0; i < ctx->nb_files; i++) {
+        int size = iso_record_size(ctx->files[i].name) + 2;
+
+        if (used + size > DVD_BLOCK_LEN) {
+            ctx->iso_vts_dir_sectors++;
+            used = 0;
+        }
+        used += size;
+    }
+
+    sector = ctx->data_sector;
+    for (i = 0; i < ctx->nb_files; i++) {
+        ctx->files[i].sector = sector;
+        sector += size_to_sectors(ctx->files[i].size);
+    }
+
+    ctx->end_sector = sector;
+}
+
+static void iso_dir_record(IsoContext *ctx, uint8_t *buf, const char *name,
+                           int name_len, int32_t sector, uint32_t size,
+                           int dir)
+{
+    int len = (33 + name_len + 1) & ~1;
+
+    memset(buf, 0, len);
+    buf[0] = len;
+    iso_both32(buf + 2,  sector);
+    iso_both32(buf + 10, size);
+    buf[18] = ctx->tm.tm_year;
+    buf[19] = ctx->tm.tm_mon + 1;
+    buf[20] = ctx->tm.tm_mday;
+    buf[21] = ctx->tm.tm_hour;
+    buf[22] = ctx->tm.tm_min;
+    buf[23] = ctx->tm.tm_sec;
+    buf[25] = dir ? 2 : 0;
+    iso_both16(buf + 28, 1);
+    buf[32] = name_len;
+    memcpy(buf + 33, name, name_len);
+}
+
+static void iso_date(IsoContext *ctx, uint8_t *buf)
+{
+    char date[17];
+
+    snprintf(date, sizeof(date), "%04d%02d%02d%02d%02d%02d00",
+             ctx->tm.tm_year + 1900, ctx->tm.tm_mon + 1, ctx->tm.tm_mday,
+             ctx->tm.tm_hour, ctx->tm.tm_min, ctx->tm.tm_sec);
+    memcpy(buf, date, 16);
+    buf[16] = 0;
+}
+
+static void path_record(uint8_t *buf, const char *name, int32_t sector,
+                        int big_endian)
+{
+    int len = strlen(name) ? strlen(name) : 1;
+
+    buf[0] = len;
+    if (big_endian) {
+        AV_WB32(buf + 2, sector);
+        AV_WB16(buf + 6, 1);
+    } else {
+        AV_WL32(buf + 2, sector);
+        AV_WL16(buf + 6, 1);
+    }
+    memcpy(buf + 8, name, strlen(name));
+}
+
+/*
+ * The root and its two directories, in the L and M byte order.
+ */
+static void path_table(uint8_t *buf, int32_t root, int32_t audio,
+                       int32_t video, int big_endian)
+{
+    path_record(buf,      "",         root,  big_endian);
+    path_record(buf + 10, "AUDIO_TS", audio, big_endian);
+    path_record(buf + 26, "VIDEO_TS", video, big_endian);
+}
+
+static void write_iso9660(IsoContext *ctx)
+{
+    int32_t root  = ISO_DIR_SECTOR;
+    int32_t audio = ISO_DIR_SECTOR + 1;
+    int32_t video = ISO_DIR_SECTOR + 2;
+    uint32_t video_size = ctx->iso_vts_dir_sectors * DVD_BLOCK_LEN;
+    IsoFile **sorted;
+    uint8_t *p;
+    int i, used;
+
+    p = sector_at(ctx, ISO_PVD_SECTOR);
+    p[0] = 1;
+    memcpy(p + 1, "CD001", 5);
+    p[6] = 1;
+    iso_string(p + 8,  32, "");
+    iso_string(p + 40, 32, ctx->label);
+    iso_both32(p + 80, ctx->end_sector + 1);
+    iso_both16(p + 120, 1);
+    iso_both16(p + 124, 1);
+    iso_both16(p + 128, DVD_BLOCK_LEN);
+    iso_both32(p + 132, 42);
+    AV_WL32(p + 140, ISO_PATH_L_SECTOR);
+    AV_WB32(p + 148, ISO_PATH_M_SECTOR);
+    iso_dir_record(ctx, p + 156, "\0", 1, root, DVD_BLOCK_LEN, 1);
+    iso_string(p + 190, 128, "");
+    iso_string(p + 318, 128, "");
+    iso_string(p + 446, 128, "");
+    iso_string(p + 574, 128, "DVDTOOLS");
+    iso_string(p + 702, 37 * 3, "");
+    iso_date(ctx, p + 813);
+    iso_date(ctx, p + 830);
+    memset(p + 847, '0', 16);
+    memset(p + 864, '0', 16);
+    p[881] = 1;
+
+    p = sector_at(ctx, ISO_PVD_SECTOR + 1);
+    p[0] = 255;
+    memcpy(p + 1, "CD001", 5);
+    p[6] = 1;
+
+    // The UDF volume recognition sequence follows.
+    memcpy(sector_at(ctx, 18) + 1, "BEA01", 5);
+    memcpy(sector_at(ctx, 19) + 1, "NSR02", 5);
+    memcpy(sector_at(ctx, 20) + 1, "TEA01", 5);
+    for (i = 18; i <= 20; i++)
+        sector_at(ctx, i)[6] = 1;
+
+    path_table(sector_at(ctx, ISO_PATH_L_SECTOR), root, audio, video, 0);
+    path_table(sector_at(ctx, ISO_PATH_M_SECTOR), root, audio, video, 1);
+
+    p = sector_at(ctx, root);
+    iso_dir_record(ctx, p,       "\0", 1, root,  DVD_BLOCK_LEN, 1);
+    iso_dir_record(ctx, p + 34,  "\1", 1, root,  DVD_BLOCK_LEN, 1);
+    iso_dir_record(ctx, p + 68,  "AUDIO_TS", 8, audio, DVD_BLOCK_LEN, 1);
+    iso_dir_record(ctx, p + 110, "VIDEO_TS", 8, video, video_size, 1);
+
+    p = sector_at(ctx, audio);
+    iso_dir_record(ctx, p,      "\0", 1, audio, DVD_BLOCK_LEN, 1);
+    iso_dir_record(ctx, p + 34, "\1", 1, root,  DVD_BLOCK_LEN, 1);
+
+    p = sector_at(ctx, video);
+    iso_dir_record(ctx, p,      "\0", 1, video, video_size, 1);
+    iso_dir_record(ctx, p + 34, "\1", 1, root,  DVD_BLOCK_LEN, 1);
+    used = 68;
+
+    sorted = av_malloc(ctx->nb_files * sizeof(*sorted));
+    if (!sorted)
+        return;
+    for (i = 0; i < ctx->nb_files; i++)
+        sorted[i] = ctx->files + i;
+    qsort(sorted, ctx->nb_files, sizeof(*sorted), cmp_name);
+
+    for (i = 0; i < ctx->nb_files; i++) {
+        char name[32];
+        int len;
+
+        snprintf(name, sizeof(name), "%s;1", sorted[i]->name);
+        len = iso_record_size(name);
+
+        if (used + len > DVD_BLOCK_LEN) {
+            p   += DVD_BLOCK_LEN;
+            used = 0;
+        }
+
+        iso_dir_record(ctx, p + used, name, strlen(name),
+                       sorted[i]->sector, sorted[i]->size, 0);
+        used += len;
+    }
+
+    av_free(sorted);
+}
+
+static void write_fid(IsoContext *ctx, uint8_t *buf, int32_t lbn,
+                      const char *name, int32_t fe_lbn, int flags)
+{
+    int len = fid_size(name);
+    int l   = *name ? 1 + strlen(name) : 0;
+
+    AV_WL16(buf + 16, 1);
+    buf[18] = flags;
+    buf[19] = l;
+    udf_long_ad(buf + 20, DVD_BLOCK_LEN, fe_lbn);
+    AV_WL16(buf + 36, 0);
+    if (l) {
+        buf[38] = 8;
+        memcpy(buf + 39, name, l - 1);
+    }
+
+    udf_tag(ctx, buf, TAG_FID, lbn, len);
+}
+
+static void write_fe(IsoContext *ctx, int32_t lbn, int dir, int links,
+                     int64_t size, int32_t data_lbn, uint64_t unique_id)
+{
+    uint8_t *p      = sector_at(ctx, UDF_PARTITION_START + lbn);
+    int32_t blocks  = size_to_sectors(size);
+
+    AV_WL16(p + 16 + 4, 4);
+    AV_WL16(p + 16 + 8, 1);
+    p[16 + 11] = dir ? 4 : 5;
+    AV_WL32(p + 36, 0xffffffff);
+    AV_WL32(p + 40, 0xffffffff);
+    AV_WL32(p + 44, 0x14a5);
+    AV_WL16(p + 48, links);
+    AV_WL64(p + 56, size);
+    AV_WL64(p + 64, blocks);
+    udf_timestamp(ctx, p + 72);
+    udf_timestamp(ctx, p + 84);
+    udf_timestamp(ctx, p + 96);
+    AV_WL32(p + 108, 1);
+    udf_regid(p + 128, "*dvdtools", 0);
+    AV_WL64(p + 160, unique_id);
+    AV_WL32(p + 168, 0);
+    AV_WL32(p + 172, 8);
+    AV_WL32(p + 176, size);
+    AV_WL32(p + 180, data_lbn);
+
+    udf_tag(ctx, p, TAG_FE, lbn, 184);
+}
+
+/*
+ * The volume descriptor sequence is written twice, main and reserve.
+ */
+static void write_vds(IsoContext *ctx, int32_t start, int32_t part_len)
+{
+    char volset[128];
+    uint8_t *p;
+
+    p = sector_at(ctx, start);
+    AV_WL32(p + 16, 0);
+    udf_dstring(p + 24, 32, ctx->label);
+    AV_WL16(p + 56, 1);
+    AV_WL16(p + 58, 1);
+    AV_WL16(p + 60, 2);
+    AV_WL16(p + 62, 2);
+    AV_WL32(p + 64, 1);
+    AV_WL32(p + 68, 1);
+    snprintf(volset, sizeof(volset), "%08X%s",
+             (unsigned)mktime(&ctx->tm), ctx->label);
+    udf_dstring(p + 72, 128, volset);
+    udf_charspec(p + 200);
+    udf_charspec(p + 264);
+    udf_regid(p + 344, "", 0);
+    udf_timestamp(ctx, p + 376);
+    udf_regid(p + 388, "*dvdtools", 0);
+    udf_tag(ctx, p, TAG_PVD, start, 512);
+
+    p = sector_at(ctx, start + 1);
+    AV_WL32(p + 16, 1);
+    udf_regid(p + 20, "*UDF LV Info", 1);
+    udf_charspec(p + 52);
+    udf_dstring(p + 52 + 64, 128, ctx->label);
+    udf_regid(p + 52 + 300, "*dvdtools", 0);
+    udf_tag(ctx, p, TAG_IUVD, start + 1, 512);
+
+    p = sector_at(ctx, start + 2);
+    AV_WL32(p + 16, 2);
+    AV_WL16(p + 20, 1);
+    AV_WL16(p + 22, 0);
+    udf_regid(p + 24, "+NSR02", 0);
+    AV_WL32(p + 184, 1);
+    AV_WL32(p + 188, UDF_PARTITION_START);
+    AV_WL32(p + 192, part_len);
+    udf_regid(p + 196, "*dvdtools", 0);
+    udf_tag(ctx, p, TAG_PD, start + 2, 512);
+
+    p = sector_at(ctx, start + 3);
+    AV_WL32(p + 16, 3);
+    udf_charspec(p + 20);
+    udf_dstring(p + 84, 128, ctx->label);
+    AV_WL32(p + 212, DVD_BLOCK_LEN);
+    udf_regid(p + 216, "*OSTA UDF Compliant", 1);
+    udf_long_ad(p + 248, DVD_BLOCK_LEN, 0);
+    AV_WL32(p + 264, 6);
+    AV_WL32(p + 268, 1);
+    udf_regid(p + 272, "*dvdtools", 0);
+    AV_WL32(p + 432, 2 * DVD_BLOCK_LEN);
+    AV_WL32(p + 436, UDF_LVID_SECTOR);
+    p[440] = 1;
+    p[441] = 6;
+    AV_WL16(p + 442, 1);
+    AV_WL16(p + 444, 0);
+    udf_tag(ctx, p, TAG_LVD, start + 3, 446);
+
+    p = sector_at(ctx, start + 4);
+    AV_WL32(p + 16, 4);
+    AV_WL32(p + 20, 0);
+    udf_tag(ctx, p, TAG_USD, start + 4, 24);
+
+    udf_tag(ctx, sector_at(ctx, start + 5), TAG_TD, start + 5, 512);
+}
+
+static void write_anchor(IsoContext *ctx, uint8_t *p, int32_t sector)
+{
+    memset(p, 0, DVD_BLOCK_LEN);
+    AV_WL32(p + 16, 16 * DVD_BLOCK_LEN);
+    AV_WL32(p + 20, UDF_MAIN_VDS);
+    AV_WL32(p + 24, 16 * DVD_BLOCK_LEN);
+    AV_WL32(p + 28, UDF_RESERVE_VDS);
+    udf_tag(ctx, p, TAG_AVDP, sector, 512);
+}
+
+static void write_udf(IsoContext *ctx)
+{
+    int32_t part_len = ctx->end_sector - UDF_PARTITION_START;
+    int nb_entries   = ctx->nb_files + 3;
+    uint8_t *p;
+    int i, off;
+
+    write_vds(ctx, UDF_MAIN_VDS, part_len);
+    write_vds(ctx, UDF_RESERVE_VDS, part_len);
+
+    p = sector_at(ctx, UDF_LVID_SECTOR);
+    udf_timestamp(ctx, p + 16);
+    AV_WL32(p + 28, 1);
+    AV_WL64(p + 40, 16 + nb_entries);
+    AV_WL32(p + 72, 1);
+    AV_WL32(p + 76, 46);
+    AV_WL32(p + 80, 0);
+    AV_WL32(p + 84, part_len);
+    udf_regid(p + 88, "*dvdtools", 0);
+    AV_WL32(p + 120, ctx->nb_files);
+    AV_WL32(p + 124, 3);
+    AV_WL16(p + 128, 0x0102);
+    AV_WL16(p + 130, 0x0102);
+    AV_WL16(p + 132, 0x0102);
+    udf_tag(ctx, p, TAG_LVID, UDF_LVID_SECTOR, 134);
+    udf_tag(ctx, sector_at(ctx, UDF_LVID_SECTOR + 1), TAG_TD,
+            UDF_LVID_SECTOR + 1, 512);
+
+    write_anchor(ctx, sector_at(ctx, UDF_ANCHOR_SECTOR), UDF_ANCHOR_SECTOR);
+
+    // File set descriptor and terminator, the tags are partition relative.
+    p = sector_at(ctx, UDF_PARTITION_START);
+    udf_timestamp(ctx, p + 16);
+    AV_WL16(p + 28, 3);
+    AV_WL16(p + 30, 3);
+    AV_WL32(p + 32, 1);
+    AV_WL32(p + 36, 1);
+    udf_charspec(p + 48);
+    udf_dstring(p + 112, 128, ctx->label);
+    udf_charspec(p + 240);
+    udf_dstring(p + 304, 32, ctx->label);
+    udf_long_ad(p + 400, DVD_BLOCK_LEN, 2);
+    udf_regid(p + 416, "*OSTA UDF Compliant", 1);
+    udf_tag(ctx, p, TAG_FSD, 0, 512);
+    udf_tag(ctx, sector_at(ctx, UDF_PARTITION_START + 1), TAG_TD, 1, 512);
+
+    // Root, its parent is itself.
+    off = fid_size("") + fid_size("AUDIO_TS") + fid_size("VIDEO_TS");
+    write_fe(ctx, 2, 1, 3, off, 3, 0);
+    p = sector_at(ctx, UDF_PARTITION_START + 3);
+    write_fid(ctx, p, 3, "", 2, 0x0a);
+    p += fid_size("");
+    write_fid(ctx, p, 3, "AUDIO_TS", 4, 0x02);
+    p += fid_size("AUDIO_TS");
+    write_fid(ctx, p, 3, "VIDEO_TS", 6, 0x02);
+
+    write_fe(ctx, 4, 1, 1, fid_size(""), 5, 16);
+    write_fid(ctx, sector_at(ctx, UDF_PARTITION_START + 5), 5, "", 2, 0x0a);
+
+    write_fe(ctx, 6, 1, 1, ctx->vts_dir_bytes, ctx->vts_dir_lbn, 17);
+    p   = sector_at(ctx, UDF_PARTITION_START + ctx->vts_dir_lbn);
+    off = 0;
+    write_fid(ctx, p, ctx->vts_dir_lbn, "", 2, 0x0a);
+    off += fid_size("");
+
+    for (i = 0; i < ctx->nb_files; i++) {
+        IsoFile *f = ctx->files + i;
+
+        write_fid(ctx, p + off, ctx->vts_dir_lbn + off / DVD_BLOCK_LEN,
+                  f->name, f->fe_lbn, 0);
+        off += fid_size(f->name);
+
+        write_fe(ctx, f->fe_lbn, 0, 1, f->size,
+                 f->sector - UDF_PARTITION_START, 18 + i);
+    }
+}
+
+/*
+ * The VMG addresses the title sets, they must be where the image puts
+ * them.
+ */
+static int check_title_sets(IsoContext *ctx)
+{
+    char name[1024];
+    uint8_t *ifo;
+    int64_t size = ctx->layout.ts[0].ifo_size;
+    int32_t tt_srpt;
+    FILE *f;
+    int i, nb, ret = 0;
+
+    snprintf(name, sizeof(name), "%s/VIDEO_TS/VIDEO_TS.IFO", ctx->path);
+
+    if (!(ifo = av_malloc(size)))
+        return AVERROR(ENOMEM);
+
+    if (!(f = fopen(name, "rb")) || fread(ifo, 1, size, f) != size) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot read %s\n", name);
+        if (f)
+            fclose(f);
+        av_free(ifo);
+        return AVERROR(EIO);
+    }
+    fclose(f);
+
+    tt_srpt = AV_RB32(ifo + 0xc4) * DVD_BLOCK_LEN;
+    nb      = tt_srpt + 8 <= size ? AV_RB16(ifo + tt_srpt) : 0;
+
+    for (i = 0; i < nb && tt_srpt + 8 + 12 * (i + 1) <= size; i++) {
+        const uint8_t *t = ifo + tt_srpt + 8 + 12 * i;
+        int nr           = t[6];
+        int32_t sector   = AV_RB32(t + 8);
+
+        if (nr < 1 || nr > ctx->layout.nb_title_sets ||
+            sector != ctx->layout.ts[nr].start_sector) {
+            av_log(NULL, AV_LOG_ERROR,
+                   "Title %d is at 0x%08"PRIx32" in the VMG, the title set %d "
+                   "is at 0x%08"PRIx32", run rewrite_ifo again\n",
+                   i + 1, sector, nr,
+                   nr >= 1 && nr <= ctx->layout.nb_title_sets ?
+                   ctx->layout.ts[nr].start_sector : 0);
+            ret = AVERROR_INVALIDDATA;
+        }
+    }
+
+    av_free(ifo);
+
+    return ret;
+}
+
+static int copy_file(IsoContext *ctx, AVIOContext *out, AVIOContext **title,
+                     IsoFile *f, uint8_t *buf)
+{
+    AVIOContext *in = NULL;
+    int64_t left    = f->size;
+    char url[4096];
+    int ret;
+
+    if (f->type == 2) {
+        if (f->part == 1) {
+            title_parts(url, sizeof(url), ctx->path, f->idx);
+            if ((ret = avio_open(title, url, AVIO_FLAG_READ)) < 0)
+                goto fail;
+        }
+        in = *title;
+    } else {
+        struct stat st;
+
+        snprintf(url, sizeof(url), "%s/VIDEO_TS/%s", ctx->path, f->name);
+
+        // A missing BUP is the IFO again.
+        if (f->type == 3 && stat(url, &st) < 0)
+            memcpy(url + strlen(url) - 3, "IFO", 3);
+
+        if ((ret = avio_open(&in, url, AVIO_FLAG_READ)) < 0)
+            goto fail;
+    }
+
+    while (left > 0) {
+        int n = FFMIN(left, COPY_BLOCKS * DVD_BLOCK_LEN);
+
+        if (avio_read(in, buf, n) != n) {
+            ret = AVERROR(EIO);
+            goto fail;
+        }
+        avio_write(out, buf, n);
+        if (out->error) {
+            ret = out->error;
+            goto fail;
+        }
+        left -= n;
+    }
+
+    // Sector aligned
+    memset(buf, 0, DVD_BLOCK_LEN);
+    avio_write(out, buf,
+               size_to_sectors(f->size) * DVD_BLOCK_LEN - f->size);
+    if (out->error) {
+        ret = out->error;
+        goto fail;
+    }
+
+    if (f->type != 2)
+        avio_close(in);
+    else if ((int64_t)(f->part - 1) * PART_SIZE + f->size >=
+             ctx->layout.ts[f->idx].title_size)
+        avio_closep(title);
+
+    return 0;
+
+fail:
+    av_log(NULL, AV_LOG_ERROR, "Cannot copy %s\n", f->name);
+    if (in && f->type != 2)
+        avio_close(in);
+
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    IsoContext ctx = { NULL };
+    AVIOContext *out = NULL, *title = NULL;
+    uint8_t *buf = NULL;
+    time_t now = time(NULL);
+    int i, ret;
+
+    av_register_all();
+
+    if (argc < 3)
+        help(argv[0]);
+
+    ctx.path = argv[1];
+    snprintf(ctx.label, sizeof(ctx.label), "%s",
+             argc > 3 ? argv[3] : "DVD_VIDEO");
+    gmtime_r(&now, &ctx.tm);
+    init_crc(&ctx);
+
+    if (scan_disc_layout(&ctx.layout, ctx.path) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find VIDEO_TS.IFO in %s\n",
+               ctx.path);
+        return 1;
+    }
+
+    if (collect_files(&ctx) < 0 ||
+        check_title_sets(&ctx) < 0)
+        return 1;
+
+    plan_image(&ctx);
+
+    if (ISO_DIR_SECTOR + 2 + ctx.iso_vts_dir_sectors > UDF_ANCHOR_SECTOR) {
+        av_log(NULL, AV_LOG_ERROR, "Too many files\n");
+        return 1;
+    }
+
+    ctx.meta = av_mallocz((int64_t)ctx.data_sector * DVD_BLOCK_LEN);
+    buf      = av_malloc(COPY_BLOCKS * DVD_BLOCK_LEN);
+    if (!ctx.meta || !buf)
+        return 1;
+
+    write_iso9660(&ctx);
+    write_udf(&ctx);
+
+    ret = avio_open(&out, !strcmp(argv[2], "-") ? "pipe:" : argv[2],
+                    AVIO_FLAG_WRITE);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s\n", argv[2]);
+        return 1;
+    }
+
+    avio_write(out, ctx.meta, (int64_t)ctx.data_sector * DVD_BLOCK_LEN);
+
+    for (i = 0; i < ctx.nb_files; i++)
+        if (copy_file(&ctx, out, &title, ctx.files + i, buf) < 0) {
+            avio_closep(&title);
+            avio_closep(&out);
+            return 1;
+        }
+
+    write_anchor(&ctx, buf, ctx.end_sector);
+    avio_write(out, buf, DVD_BLOCK_LEN);
+
+    ret = out->error;
+    if (avio_closep(&out) < 0 || ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot write %s\n", argv[2]);
+        return 1;
+    }
+
+    av_log(NULL, AV_LOG_INFO, "%s: %d files, %"PRId32" sectors, "
+           "VIDEO_TS.IFO at 0x%08"PRIx32"\n",
+           argv[2], ctx.nb_files, ctx.end_sector + 1, ctx.data_sector);
+
+    for (i = 1; i <= ctx.layout.nb_title_sets; i++)
+        av_log(NULL, AV_LOG_VERBOSE, "title set %d at 0x%08"PRIx32"\n",
+               i, ctx.data_sector + ctx.layout.ts[i].start_sector);
+
+    av_free(buf);
+    av_free(ctx.meta);
+    av_free(ctx.files);
+
+    return 0;
+}
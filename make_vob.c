@@ -1,7 +1,14 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <libavformat/avio.h>
 #include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
 #include <libavutil/intreadwrite.h>
 
 #include "common.h"
@@ -10,34 +17,320 @@ static void help(char *name)
 {
     fprintf(stderr,
             "Repair the NAV Packet sector information\n"
-            "%s <vts> <outvts>\n"
+            "%s [-S] [-D] [-s] [-d] [-p] [-t] [-A <list>] [-P <list>] <vts> <outvts>\n"
+            "%s [-S] [-y] -i <vts>\n"
+            "%s [-S] [-D] -j <threads> <vts> <outvts>\n"
+            "%s -u <segment> <vts>\n"
+            "-s: single pass, read and write sequentially, - for pipes\n"
+            "-d: single pass over the segments in the vts directory or\n"
+            "    listed one per line in the vts manifest\n"
+            "-p: with -s or -d drop the padding packs\n"
+            "-A: with -s or -d keep only the listed audio streams,\n"
+            "    e.g. 0,2, numbering them again in the list order\n"
+            "-P: the same for the subpicture streams\n"
+            "-t: with -s or -d rebase the timestamps so they are continuous\n"
+            "-i: patch the NAV sectors of vts in place, reading only them\n"
+            "-y: with -i rebuild the sync information as well, reading\n"
+            "    every VOBU in full\n"
+            "-j: patch with this many threads, reading and writing at\n"
+            "    the precomputed offsets\n"
+            "-u: replace the cells the segment carries in vts, moving\n"
+            "    the rest only if it grew, and save the index in vts.idx\n"
+            "-S: split the output in 1GB parts, outvts being the first,\n"
+            "    VTS_xx_1.VOB, with -i patch the parts of vts\n"
+            "-D: write outvts with direct I/O, preallocating it when the\n"
+            "    size is known, and drop vts from the page cache once read\n"
             "vts: collated vts file.\n"
             "outvts: outputvts file",
-            name);
+            name, name, name, name);
     exit(0);
 }
 
-int wrap_count = 0;
-
-#define WRAP_SIZE (1024 * 1024 * 1024 / 2048)
 AVIOContext *out = NULL;
 
-static int write_vob(VOBU *vobu, AVIOContext *in /* , int title, int *part */)
+static int split            = 0;
+static const char *out_name = NULL;
+static int out_part         = 0;
+static int64_t out_written  = 0;
+static int64_t out_size     = 0;    ///< 0 if not known in advance
+static int rebuild_synci    = 0;
+static int io_flags         = 0;
+
+static PackFilter filter;
+static int compact          = 0;
+static int64_t dropped      = 0;
+static int rebase           = 0;
+
+static uint8_t *vobu_buf       = NULL;
+static unsigned vobu_buf_size  = 0;
+
+/*
+ * VTS_xx_1.VOB is the first part, the others differ only in the digit.
+ */
+static int part_name(char *buf, int size, const char *name, int part)
 {
-    int len = vobu->end_sector - 1 - vobu->start_sector;
-    uint8_t buf[2048];
-    int size;
-    int n;
-    int64_t pos;
+    char *ext;
+
+    snprintf(buf, size, "%s", name);
+    ext = strrchr(buf, '.');
+
+    if (!ext || ext == buf || ext[-1] != '1') {
+        av_log(NULL, AV_LOG_ERROR, "%s is not named as a first part\n",
+               name);
+        return AVERROR(EINVAL);
+    }
+
+    ext[-1] += part;
+
+    return 0;
+}
+
+/*
+ * Remove the parts from first on, left over by a longer title, the
+ * other tools would take them as part of this one.
+ */
+static void remove_stale_parts(const char *name, int first)
+{
+    char part[1024];
+    int i;
+
+    for (i = first; i < MAX_PARTS; i++)
+        if (!part_name(part, sizeof(part), name, i) &&
+            !unlink(part))
+            av_log(NULL, AV_LOG_INFO, "Removed the stale %s\n", part);
+}
+
+static int open_out_part(void)
+{
+    char name[1024];
+    int64_t size = FFMAX(out_size - out_part * PART_SIZE, 0);
+    int ret;
+
+    if (!split) {
+        drop_vobu_index(out_name);
+        return open_file_io(&out, out_name, 1, out_size, io_flags);
+    }
+
+    if ((ret = part_name(name, sizeof(name), out_name, out_part)) < 0)
+        return ret;
+
+    drop_vobu_index(name);
+
+    return open_file_io(&out, name, 1, FFMIN(size, PART_SIZE), io_flags);
+}
+
+/*
+ * Write to the output moving to the next part at the boundary, the
+ * sector numbering in the NAV packets stays continuous across them.
+ */
+static int write_out(const uint8_t *buf, int size)
+{
+    int ret;
+
+    while (split && out_written + size > PART_SIZE * (out_part + 1)) {
+        int n = PART_SIZE * (out_part + 1) - out_written;
+
+        avio_write(out, buf, n);
+        if ((ret = close_file_io(&out)) < 0)
+            return ret;
+
+        buf         += n;
+        size        -= n;
+        out_written += n;
+
+        if (++out_part >= MAX_PARTS) {
+            av_log(NULL, AV_LOG_ERROR, "The title does not fit %d parts\n",
+                   MAX_PARTS);
+            return AVERROR(ENOSPC);
+        }
+
+        if ((ret = open_out_part()) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot open the part %d of %s\n",
+                   out_part + 1, out_name);
+            return ret;
+        }
+    }
 
+    avio_write(out, buf, size);
+    out_written += size;
+
+    return 0;
+}
 
 /*
-    if ((vobu->end_sector - *part * WRAP_SIZE) > WRAP_SIZE) {
-        printf("----->8-----\n    cut here\n-----8<------\n");
-        (*part)++;
-        split = 1;
+ * The parts of a title as a single file for pread and pwrite.
+ */
+typedef struct PartFile {
+    int fd[MAX_PARTS];
+    int nb_parts;
+} PartFile;
+
+/*
+ * Open the existing parts, or nb_parts new ones of size bytes overall.
+ */
+static int open_parts(PartFile *f, const char *name, int flags,
+                      int nb_parts, int64_t size)
+{
+    char part[1024];
+    int i, ret;
+
+    f->nb_parts = 0;
+
+    for (i = 0; i < (split ? MAX_PARTS : 1); i++) {
+        if (split && (ret = part_name(part, sizeof(part), name, i)) < 0)
+            return ret;
+
+        f->fd[i] = open(split ? part : name, flags, 0666);
+        if (f->fd[i] < 0) {
+            if (i && !nb_parts)
+                break;
+            av_log(NULL, AV_LOG_ERROR, "Cannot open %s\n",
+                   split ? part : name);
+            return AVERROR(errno);
+        }
+        f->nb_parts++;
+
+        if (nb_parts) {
+            int64_t len = split ? FFMIN(size - i * PART_SIZE, PART_SIZE) : size;
+
+            drop_vobu_index(split ? part : name);
+
+            if (io_flags & IO_DIRECT)
+                preallocate(f->fd[i], len);
+            if (ftruncate(f->fd[i], len) < 0)
+                av_log(NULL, AV_LOG_WARNING, "Cannot preallocate %s\n",
+                       split ? part : name);
+            if (i + 1 == nb_parts) {
+                if (split)
+                    remove_stale_parts(name, nb_parts);
+                break;
+            }
+        }
     }
-*/
+
+    return 0;
+}
+
+static void close_parts(PartFile *f)
+{
+    int i;
+
+    for (i = 0; i < f->nb_parts; i++)
+        close(f->fd[i]);
+}
+
+static int part_io(PartFile *f, uint8_t *buf, int64_t size, int64_t offset,
+                   int write)
+{
+    int ret;
+
+    while (size > 0) {
+        int p       = split ? offset / PART_SIZE : 0;
+        int64_t off = split ? offset % PART_SIZE : offset;
+        int64_t n   = split ? FFMIN(size, PART_SIZE - off) : size;
+
+        if (p >= f->nb_parts)
+            return AVERROR_EOF;
+
+        ret = write ? write_at(f->fd[p], buf, n, off)
+                    : read_at(f->fd[p], buf, n, off);
+        if (ret < 0)
+            return ret;
+
+        buf    += n;
+        size   -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+/*
+ * The concat protocol lets populate_vobs index the parts as one file.
+ */
+static int parts_url(char *url, int size, const char *name, PartFile *f)
+{
+    char part[1024];
+    int i, ret;
+
+    if (!split) {
+        snprintf(url, size, "%s", name);
+        return 0;
+    }
+
+    snprintf(url, size, "concat:");
+
+    for (i = 0; i < f->nb_parts; i++) {
+        if ((ret = part_name(part, sizeof(part), name, i)) < 0)
+            return ret;
+        av_strlcatf(url, size, "%s%s", i ? "|" : "", part);
+    }
+
+    return 0;
+}
+
+/*
+ * The streaming modes know the following VOBUs only once they are
+ * written, patch the forward search information back reading and
+ * writing just the NAV sectors that need it.
+ */
+static int fill_forward_sri(VOBU *vobus, int nb_vobus)
+{
+    uint8_t buf[DVD_BLOCK_LEN];
+    PartFile f;
+    int i, patched = 0, ret;
+
+    if (!strcmp(out_name, "pipe:")) {
+        av_log(NULL, AV_LOG_WARNING, "The forward search information is "
+               "left as end of cell, run make_vob -i on the output\n");
+        return 0;
+    }
+
+    if ((ret = open_parts(&f, out_name, O_RDWR, 0, 0)) < 0) {
+        close_parts(&f);
+        return ret;
+    }
+
+    for (i = 0; i < nb_vobus; i++) {
+        int64_t pos = (int64_t)vobus[i].start_sector * DVD_BLOCK_LEN;
+        vobu_sri_t sri;
+
+        build_vobu_sri(vobus, nb_vobus, i, &sri);
+
+        if (!memcmp(&vobus[i].dsi.vobu_sri, &sri, sizeof(sri)))
+            continue;
+
+        if ((ret = part_io(&f, buf, DVD_BLOCK_LEN, pos, 0)) < 0)
+            break;
+
+        patch_vobu_sri(buf, &sri);
+
+        if ((ret = part_io(&f, buf, DVD_BLOCK_LEN, pos, 1)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot write the NAV at 0x%08"PRIx32"\n",
+                   vobus[i].start_sector);
+            break;
+        }
+
+        patched++;
+    }
+
+    av_log(NULL, AV_LOG_VERBOSE, "Completed the search information of %d "
+           "of %d NAV sectors\n", patched, nb_vobus);
+
+    close_parts(&f);
+
+    return ret;
+}
+
+static int write_vob(VOBU *vobus, int nb_vobus, int i, AVIOContext *in)
+{
+    VOBU *vobu = vobus + i;
+    vobu_sri_t sri;
+    synci_t synci;
+    int len = vobu->end_sector - 1 - vobu->start_sector;
+    int size = vobu->end - vobu->start;
+    int n, ret;
+
 
     av_log(NULL, AV_LOG_DEBUG, "0x%08"PRIx32"\n"
             "0x%08"PRIx32" 0x%08"PRIx32"\n"
@@ -61,71 +354,944 @@ static int write_vob(VOBU *vobu, AVIOContext *in /* , int title, int *part */)
            vobu->start);
     avio_seek(in, vobu->start, SEEK_SET);
 
+    av_fast_malloc(&vobu_buf, &vobu_buf_size, FFMAX(size, DVD_BLOCK_LEN));
+    if (!vobu_buf)
+        return AVERROR(ENOMEM);
 
-    // write down the NAV_PACK
-
-    n = avio_read(in, buf, sizeof(buf));
-    if (n <= 0) {
+    n = avio_read(in, vobu_buf, size);
+    if (n < DVD_BLOCK_LEN) {
         fprintf(stderr, "Can't read!\n");
         exit(1);
     }
+    if (n < size)
+        fprintf(stderr, "OMGBBQ\n");
+
+    // patch the NAV_PACK before writing it down
+
+    if ((ret = patch_nav(vobu_buf, vobu->start_sector, len, vobu->next)) < 0)
+        return ret;
+
+    build_vobu_sri(vobus, nb_vobus, i, &sri);
+    patch_vobu_sri(vobu_buf, &sri);
+
+    build_vobu_synci(vobu_buf, n / DVD_BLOCK_LEN, &synci);
+    patch_vobu_synci(vobu_buf, &synci);
+
+    av_log(NULL, AV_LOG_VERBOSE, "Next %"PRIx32"\n",
+           vobu->next);
 
-    pos = avio_tell(out);
     av_log(NULL, AV_LOG_VERBOSE, "Start Position %"PRId64"\n",
            avio_tell(out));
 
-    avio_write(out, buf, n);
+    return write_out(vobu_buf, n);
+}
 
-    avio_seek(out, pos, SEEK_SET);
+typedef struct StreamContext {
+    AVIOContext *in;
+    char **inputs;      ///< the segments still to be read, if any
+    int nb_inputs;
+    int cur_input;
+    VOBU vobu;          ///< the NAV of the buffered VOBU
+    VOBU *index;        ///< the VOBUs written so far, as written
+    int nb_index;
+    int index_size;
+    int size;           ///< bytes buffered, NAV sector included
+    int32_t sector;     ///< output sector of the buffered VOBU
+    int64_t ts_offset;  ///< added to the timestamps, 90kHz
+    int64_t next_ptm;   ///< rebased vobu_e_ptm of the last VOBU written
+    int64_t last_scr;   ///< last SCR written, 27MHz
+} StreamContext;
 
-    avio_seek(out, 44 + 1, SEEK_CUR);
+/*
+ * Move the timestamps of the buffered VOBU so that it starts where the
+ * previous one ended when it restarts or jumps ahead more than a second,
+ * as the independently encoded segments do. The SCR is kept increasing.
+ */
+static void rebase_vobu(StreamContext *s, int nb_sectors)
+{
+    int64_t s_ptm = s->vobu.pci.pci_gi.vobu_s_ptm;
+    int64_t e_ptm = s->vobu.pci.pci_gi.vobu_e_ptm;
+    int i;
 
-    avio_wb32(out, vobu->start_sector);
+    if (s->sector) {
+        int64_t delta = s_ptm + s->ts_offset - s->next_ptm;
 
-    avio_seek(out, pos + 1030 + 1 + 4, SEEK_SET);
+        if (delta < 0 || delta > 90000) {
+            av_log(NULL, AV_LOG_VERBOSE, "Rebase 0x%08"PRIx32" by %"PRId64"\n",
+                   s->sector, -delta);
+            s->ts_offset -= delta;
+        }
+    }
 
-    avio_wb32(out, vobu->start_sector);
-    avio_wb32(out, len);
+    s->next_ptm = e_ptm + s->ts_offset;
 
-    avio_seek(out, 302, SEEK_CUR);
-    avio_wb32(out, vobu->next);
+    for (i = 0; i < nb_sectors; i++) {
+        uint8_t *buf = vobu_buf + i * DVD_BLOCK_LEN;
+        int64_t scr  = pack_scr(buf);
 
-    av_log(NULL, AV_LOG_VERBOSE, "Next %"PRIx32"\n",
-           vobu->next);
+        if (scr < 0)
+            continue;
 
-    avio_seek(out, pos + sizeof(buf), SEEK_SET);
+        scr += s->ts_offset * 300;
+        if (s->sector + i && scr <= s->last_scr)
+            scr = s->last_scr + PACK_SCR_TICKS;
 
-    av_log(NULL, AV_LOG_VERBOSE, "Position %"PRId64"\n",
-           avio_tell(out));
+        set_pack_scr(buf, scr);
+        shift_pes_ts(buf, s->ts_offset);
+        s->last_scr = scr;
+    }
 
-    size = vobu->end - vobu->start - sizeof(buf);
+    shift_nav_ptm(vobu_buf, s->ts_offset);
+}
 
-    while (size > 0) {
-        n = avio_read(in, buf, sizeof(buf));
-        if (n < 0) {
-            fprintf(stderr, "OMGBBQ\n");
+/*
+ * Patch the NAV of the buffered VOBU now that the following one is known,
+ * next is NULL at the end of the stream.
+ */
+static int flush_vobu(StreamContext *s, VOBU *next)
+{
+    int32_t len = s->size / DVD_BLOCK_LEN - 1;
+    vobu_sri_t sri;
+    synci_t synci;
+    int ret;
+
+    if (!s->size)
+        return 0;
+
+    if (compact && !(s->size % DVD_BLOCK_LEN)) {
+        int n = compact_vobu(vobu_buf, s->size / DVD_BLOCK_LEN, &filter);
+
+        dropped += s->size / DVD_BLOCK_LEN - n;
+        s->size  = n * DVD_BLOCK_LEN;
+        len      = n - 1;
+    }
+
+    if (rebase)
+        rebase_vobu(s, s->size / DVD_BLOCK_LEN);
+
+    s->vobu.start_sector = s->sector;
+    s->vobu.end_sector   = s->sector + len + 1;
+    s->vobu.start        = out_written;
+    s->vobu.end          = out_written + s->size;
+
+    if (!next ||
+        next->vob_id != s->vobu.vob_id ||
+        next->cell_id != s->vobu.cell_id)
+        s->vobu.next = 0x3fffffff;
+    else
+        s->vobu.next = len + 1;
+
+    if ((ret = patch_nav(vobu_buf, s->vobu.start_sector, len,
+                         s->vobu.next)) < 0)
+        return ret;
+
+    if (s->nb_index >= s->index_size) {
+        s->index_size = FFMAX(s->index_size * 2, 1024);
+        if (av_reallocp_array(&s->index, s->index_size, sizeof(*s->index)) < 0)
+            return AVERROR(ENOMEM);
+    }
+    s->index[s->nb_index++] = s->vobu;
+
+    // Only the backward search information is known at this point,
+    // fill_forward_sri completes the forward one once the output is
+    // written.
+    build_vobu_sri(s->index, s->nb_index, s->nb_index - 1, &sri);
+    patch_vobu_sri(vobu_buf, &sri);
+
+    build_vobu_synci(vobu_buf, len + 1, &synci);
+    patch_vobu_synci(vobu_buf, &synci);
+
+    // Keep what is written, rebased times included
+    parse_nav_sector(vobu_buf, s->index + s->nb_index - 1);
+
+    av_log(NULL, AV_LOG_VERBOSE, "NAV 0x%08"PRIx32" len %"PRId32" next %"PRIx32"\n",
+           s->vobu.start_sector, len, s->vobu.next);
+
+    if ((ret = write_out(vobu_buf, s->size)) < 0)
+        return ret;
+
+    s->sector += len + 1;
+    s->size    = 0;
+
+    return 0;
+}
+
+static int append_sector(StreamContext *s, const uint8_t *buf, int n)
+{
+    av_fast_malloc(&vobu_buf, &vobu_buf_size, s->size + DVD_BLOCK_LEN);
+    if (!vobu_buf)
+        return AVERROR(ENOMEM);
+
+    memcpy(vobu_buf + s->size, buf, n);
+    s->size += n;
+
+    return 0;
+}
+
+static int is_vob(const struct dirent *d)
+{
+    const char *ext = strrchr(d->d_name, '.');
+
+    return ext && !strcasecmp(ext, ".vob");
+}
+
+/*
+ * The segments are taken in name order, as cat *.vob would.
+ */
+static int open_inputs(StreamContext *s, const char *path)
+{
+    struct stat st;
+    int i;
+
+    if (stat(path, &st) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot stat %s\n", path);
+        return AVERROR(errno);
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        struct dirent **list;
+        int n = scandir(path, &list, is_vob, alphasort);
+
+        if (n < 0)
+            return AVERROR(errno);
+
+        for (i = 0; i < n; i++) {
+            char name[1024];
+
+            snprintf(name, sizeof(name), "%s/%s", path, list[i]->d_name);
+            free(list[i]);
+
+            if (av_reallocp_array(&s->inputs, s->nb_inputs + 1,
+                                  sizeof(*s->inputs)) < 0)
+                return AVERROR(ENOMEM);
+            s->inputs[s->nb_inputs++] = av_strdup(name);
+        }
+        free(list);
+    } else {
+        FILE *f = fopen(path, "r");
+        char name[1024];
+
+        if (!f)
+            return AVERROR(errno);
+
+        while (fgets(name, sizeof(name), f)) {
+            name[strcspn(name, "\r\n")] = 0;
+            if (!*name)
+                continue;
+
+            if (av_reallocp_array(&s->inputs, s->nb_inputs + 1,
+                                  sizeof(*s->inputs)) < 0)
+                return AVERROR(ENOMEM);
+            s->inputs[s->nb_inputs++] = av_strdup(name);
+        }
+        fclose(f);
+    }
+
+    return 0;
+}
+
+/*
+ * Move to the next segment, if any.
+ */
+static int next_input(StreamContext *s)
+{
+    const char *name;
+    int ret;
+
+    close_file_io(&s->in);
+
+    if (s->cur_input >= s->nb_inputs)
+        return AVERROR_EOF;
+
+    name = s->inputs[s->cur_input++];
+
+    av_log(NULL, AV_LOG_VERBOSE, "Reading %s\n", name);
+
+    ret = open_file_io(&s->in, name, 0, 0, io_flags);
+    if (ret < 0) {
+        char errbuf[128];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s: %s\n",
+               name, errbuf);
+    }
+
+    return ret;
+}
+
+static int read_sector(StreamContext *s, uint8_t *buf)
+{
+    int n, ret;
+
+    while (!s->in || (n = avio_read(s->in, buf, DVD_BLOCK_LEN)) <= 0) {
+        if (!s->inputs)
+            return 0;
+        if ((ret = next_input(s)) < 0)
+            return ret == AVERROR_EOF ? 0 : ret;
+    }
+
+    return n;
+}
+
+/*
+ * Single pass: keep at most a VOBU in memory, patch its NAV once the next
+ * NAV is found and write it out, the output is never seeked.
+ */
+static int stream_vob(StreamContext *s)
+{
+    uint8_t buf[DVD_BLOCK_LEN];
+    int n, ret, skipped = 0;
+    VOBU nav = { 0 };
+
+    while ((n = read_sector(s, buf)) > 0) {
+        if (n == sizeof(buf) &&
+            !parse_nav_sector(buf, &nav) && nav.vob_id) {
+            if ((ret = flush_vobu(s, &nav)) < 0)
+                return ret;
+            s->vobu = nav;
+        } else if (!s->size) {
+            skipped++;
+            continue;
+        }
+
+        if ((ret = append_sector(s, buf, n)) < 0)
+            return ret;
+    }
+
+    if (n < 0)
+        return n;
+
+    if (skipped)
+        av_log(NULL, AV_LOG_WARNING,
+               "Skipped %d sectors before the first NAV\n", skipped);
+
+    return flush_vobu(s, NULL);
+}
+
+/*
+ * The pack layout is already right, rewrite only the NAV sectors whose
+ * fields do not match the index.
+ */
+static int patch_vob_in_place(const char *filename)
+{
+    VOBU *vobus = NULL;
+    uint8_t *buf = NULL;
+    unsigned buf_size = 0;
+    PartFile f;
+    char url[4096];
+    int i, nb_vobus, patched = 0, ret = 0;
+
+    if ((ret = open_parts(&f, filename, O_RDWR, 0, 0)) < 0 ||
+        (ret = parts_url(url, sizeof(url), filename, &f)) < 0) {
+        close_parts(&f);
+        return ret;
+    }
+
+    if ((nb_vobus = populate_vobs(&vobus, url)) < 0) {
+        close_parts(&f);
+        return nb_vobus;
+    }
+
+    // The index is read, the NAV sectors are about to change.
+    for (i = 0; i < f.nb_parts; i++) {
+        char part[1024];
+
+        if (!split)
+            drop_vobu_index(filename);
+        else if (part_name(part, sizeof(part), filename, i) >= 0)
+            drop_vobu_index(part);
+    }
+
+    for (i = 0; i < nb_vobus; i++) {
+        VOBU *vobu  = vobus + i;
+        int32_t len = vobu->end_sector - 1 - vobu->start_sector;
+        int64_t size = rebuild_synci ? vobu->end - vobu->start : DVD_BLOCK_LEN;
+        vobu_sri_t sri;
+        synci_t synci;
+
+        if (vobu->start % DVD_BLOCK_LEN) {
+            av_log(NULL, AV_LOG_ERROR,
+                   "NAV at %"PRId64" is not sector aligned, "
+                   "rewrite the file instead\n", vobu->start);
+            ret = AVERROR_INVALIDDATA;
             break;
         }
-        avio_write(out, buf, n);
-        size -= n;
+
+        // Only the sync information needs the whole VOBU, the NAV is
+        // the only sector written back.
+        av_fast_malloc(&buf, &buf_size, size);
+        if (!buf) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+
+        if ((ret = part_io(&f, buf, size, vobu->start, 0)) < 0)
+            break;
+
+        build_vobu_sri(vobus, nb_vobus, i, &sri);
+        if (rebuild_synci)
+            build_vobu_synci(buf, size / DVD_BLOCK_LEN, &synci);
+
+        if (vobu->pci.pci_gi.nv_pck_lbn == vobu->start_sector &&
+            vobu->dsi.dsi_gi.nv_pck_lbn == vobu->start_sector &&
+            vobu->dsi.dsi_gi.vobu_ea == len &&
+            !memcmp(&vobu->dsi.vobu_sri, &sri, sizeof(sri)) &&
+            (!rebuild_synci ||
+             !memcmp(&vobu->dsi.synci, &synci, sizeof(synci))))
+            continue;
+
+        if ((ret = patch_nav(buf, vobu->start_sector, len, vobu->next)) < 0)
+            break;
+        patch_vobu_sri(buf, &sri);
+        if (rebuild_synci)
+            patch_vobu_synci(buf, &synci);
+
+        if ((ret = part_io(&f, buf, DVD_BLOCK_LEN, vobu->start, 1)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot write the NAV at 0x%08"PRIx32"\n",
+                   vobu->start_sector);
+            break;
+        }
+
+        patched++;
+    }
+
+    av_log(NULL, AV_LOG_INFO, "Patched %d of %d NAV sectors\n",
+           patched, nb_vobus);
+
+    close_parts(&f);
+    av_free(buf);
+    av_free(vobus);
+
+    return ret;
+}
+
+#define CHUNK_SIZE (8 * 1024 * 1024)
+
+static int same_ids(const VOBU *a, const VOBU *b)
+{
+    return a->vob_id == b->vob_id && a->cell_id == b->cell_id;
+}
+
+/*
+ * A padding pack following the pack last, the pack header is copied
+ * and its SCR advanced by one pack.
+ */
+static void padding_pack(uint8_t *buf, const uint8_t *last)
+{
+    int off = 14 + (last[13] & 7);
+
+    memcpy(buf, last, off);
+    set_pack_scr(buf, pack_scr(last) + PACK_SCR_TICKS);
+    AV_WB32(buf + off, PADDING_STREAM);
+    AV_WB16(buf + off + 4, DVD_BLOCK_LEN - off - 6);
+    memset(buf + off + 6, 0xff, DVD_BLOCK_LEN - off - 6);
+}
+
+/*
+ * Move the SCR, the PES timestamps and the NAV presentation times of the
+ * nb_sectors of the VOBU in buf by offset, 90kHz.
+ */
+static void shift_vobu_ts(uint8_t *buf, int nb_sectors, int64_t offset)
+{
+    int i;
+
+    for (i = 0; i < nb_sectors; i++) {
+        uint8_t *p  = buf + i * DVD_BLOCK_LEN;
+        int64_t scr = pack_scr(p);
+
+        if (scr < 0)
+            continue;
+
+        set_pack_scr(p, scr + offset * 300);
+        shift_pes_ts(p, offset);
+    }
+
+    shift_nav_ptm(buf, offset);
+}
+
+/*
+ * Move the sectors from start to the end of the file by delta sectors,
+ * from the last chunk backwards.
+ */
+static int shift_tail(int fd, int64_t start, int64_t end, int32_t delta)
+{
+    int64_t chunk = 256 * DVD_BLOCK_LEN, pos = end;
+    uint8_t *buf  = av_malloc(chunk);
+    int ret       = 0;
+
+    if (!buf)
+        return AVERROR(ENOMEM);
+
+    while (pos > start) {
+        int64_t n = FFMIN(pos - start, chunk);
+
+        pos -= n;
+        if ((ret = read_at(fd, buf, n, pos)) < 0 ||
+            (ret = write_at(fd, buf, n, pos + (int64_t)delta * DVD_BLOCK_LEN)) < 0)
+            break;
+    }
+
+    av_free(buf);
+
+    return ret;
+}
+
+/*
+ * Replace the VOBUs of the cells the segment carries, from the one of
+ * its first VOBU to the one of its last, with the segment. A smaller
+ * segment is padded to the old size so nothing else moves, a larger one
+ * moves the rest of the file. The segment timestamps are moved to start
+ * where the replaced VOBUs did. The NAV sectors are patched from the
+ * updated index, outside the segment only the ones that differ are
+ * written back, and the index is saved along the VOB.
+ */
+static int update_vob(const char *seg_name, const char *filename)
+{
+    VOBU *vobus = NULL, *seg = NULL, *v = NULL;
+    uint8_t *buf = NULL;
+    unsigned buf_size = 0;
+    int nb_vobus, nb_seg, nb, a, b, i, fd = -1, seg_fd = -1;
+    int ret = 0, patched = 0;
+    int32_t old_sectors, new_sectors, pad = 0, delta = 0, start;
+    int64_t ts_offset, seg_end;
+
+    if ((nb_seg = walk_vobs(&seg, seg_name)) < 0)
+        return nb_seg;
+
+    if (seg[0].start_sector) {
+        av_log(NULL, AV_LOG_ERROR, "%s does not start with a NAV pack\n",
+               seg_name);
+        ret = AVERROR_INVALIDDATA;
+        goto end;
     }
 
-    avio_flush(out);
+    if ((nb_vobus = populate_vobs(&vobus, filename)) < 0) {
+        ret = nb_vobus;
+        goto end;
+    }
+
+    for (a = 0; a < nb_vobus && !same_ids(vobus + a, seg); a++)
+        ;
+    for (b = a; b < nb_vobus && !same_ids(vobus + b, seg + nb_seg - 1); b++)
+        ;
+    while (b < nb_vobus && same_ids(vobus + b, seg + nb_seg - 1))
+        b++;
+
+    if (a == nb_vobus || !same_ids(vobus + b - 1, seg + nb_seg - 1)) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find the cells %d-%d to %d-%d in %s\n",
+               seg[0].vob_id, seg[0].cell_id,
+               seg[nb_seg - 1].vob_id, seg[nb_seg - 1].cell_id, filename);
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+
+    ts_offset = (int64_t)vobus[a].pci.pci_gi.vobu_s_ptm -
+                seg[0].pci.pci_gi.vobu_s_ptm;
+    seg_end   = seg[nb_seg - 1].pci.pci_gi.vobu_e_ptm + ts_offset;
+
+    if (b < nb_vobus && seg_end != vobus[b].pci.pci_gi.vobu_s_ptm)
+        av_log(NULL, AV_LOG_WARNING,
+               "The segment ends at %"PRId64", the next VOBU starts at %"PRIu32"\n",
+               seg_end, vobus[b].pci.pci_gi.vobu_s_ptm);
+
+    start       = vobus[a].start_sector;
+    old_sectors = vobus[b - 1].end_sector - start;
+    new_sectors = seg[nb_seg - 1].end_sector;
+
+    if (new_sectors < old_sectors)
+        pad = old_sectors - new_sectors;
+    else
+        delta = new_sectors - old_sectors;
+
+    nb = a + nb_seg + nb_vobus - b;
+    if (!(v = av_mallocz((nb + 1) * sizeof(*v)))) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    memcpy(v, vobus, a * sizeof(*v));
+    memcpy(v + a, seg, nb_seg * sizeof(*v));
+    memcpy(v + a + nb_seg, vobus + b, (nb_vobus - b) * sizeof(*v));
+
+    for (i = a; i < a + nb_seg; i++) {
+        v[i].start_sector += start;
+        v[i].end_sector   += start;
+        v[i].start        += (int64_t)start * DVD_BLOCK_LEN;
+        v[i].end          += (int64_t)start * DVD_BLOCK_LEN;
+    }
+    v[a + nb_seg - 1].end_sector += pad;
+    v[a + nb_seg - 1].end        += (int64_t)pad * DVD_BLOCK_LEN;
+
+    for (i = a + nb_seg; i < nb; i++) {
+        v[i].start_sector += delta;
+        v[i].end_sector   += delta;
+        v[i].start        += (int64_t)delta * DVD_BLOCK_LEN;
+        v[i].end          += (int64_t)delta * DVD_BLOCK_LEN;
+    }
+
+    link_vobus(v, nb);
+    v[nb].start_sector = -1; // Guard
+
+    if ((fd = open(filename, O_RDWR)) < 0 ||
+        (seg_fd = open(seg_name, O_RDONLY)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s\n",
+               fd < 0 ? filename : seg_name);
+        ret = AVERROR(errno);
+        goto end;
+    }
+
+    if (delta &&
+        (ret = shift_tail(fd, vobus[b - 1].end, vobus[nb_vobus - 1].end,
+                          delta)) < 0)
+        goto end;
+
+    for (i = 0; i < nb; i++) {
+        VOBU *vobu   = v + i;
+        int32_t len  = vobu->end_sector - 1 - vobu->start_sector;
+        int in_seg   = i >= a && i < a + nb_seg;
+        int64_t size = in_seg ? vobu->end - vobu->start : DVD_BLOCK_LEN;
+        vobu_sri_t sri;
+
+        build_vobu_sri(v, nb, i, &sri);
+
+        if (!in_seg &&
+            vobu->pci.pci_gi.nv_pck_lbn == vobu->start_sector &&
+            vobu->dsi.dsi_gi.nv_pck_lbn == vobu->start_sector &&
+            vobu->dsi.dsi_gi.vobu_ea == len &&
+            !memcmp(&vobu->dsi.vobu_sri, &sri, sizeof(sri)))
+            continue;
+
+        av_fast_malloc(&buf, &buf_size, size);
+        if (!buf) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+
+        if (in_seg) {
+            const VOBU *s = seg + i - a;
+            int64_t n     = s->end - s->start;
+            synci_t synci;
+            int k;
+
+            if ((ret = read_at(seg_fd, buf, n, s->start)) < 0)
+                goto end;
+
+            shift_vobu_ts(buf, n / DVD_BLOCK_LEN, ts_offset);
+
+            for (k = n / DVD_BLOCK_LEN; k < size / DVD_BLOCK_LEN; k++)
+                padding_pack(buf + k * DVD_BLOCK_LEN,
+                             buf + (k - 1) * DVD_BLOCK_LEN);
+
+            build_vobu_synci(buf, size / DVD_BLOCK_LEN, &synci);
+            patch_vobu_synci(buf, &synci);
+        } else if ((ret = read_at(fd, buf, size, vobu->start)) < 0) {
+            goto end;
+        }
+
+        if ((ret = patch_nav(buf, vobu->start_sector, len, vobu->next)) < 0)
+            goto end;
+        patch_vobu_sri(buf, &sri);
+
+        if ((ret = write_at(fd, buf, size, vobu->start)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot write the VOBU at 0x%08"PRIx32"\n",
+                   vobu->start_sector);
+            goto end;
+        }
+
+        parse_nav_sector(buf, vobu);
+        patched += !in_seg;
+    }
+
+    close(fd);
+    fd = -1;
+
+    av_log(NULL, AV_LOG_INFO,
+           "Replaced %"PRId32" sectors at 0x%08"PRIx32" with %"PRId32
+           " and %"PRId32" of padding, moved the rest by %"PRId32
+           ", patched %d other NAV sectors\n",
+           old_sectors, start, new_sectors, pad, delta, patched);
+
+    ret = save_vobu_index(v, nb, filename);
+
+end:
+    if (fd >= 0)
+        close(fd);
+    if (seg_fd >= 0)
+        close(seg_fd);
+    av_free(buf);
+    av_free(v);
+    av_free(vobus);
+    av_free(seg);
+
+    return ret;
+}
+
+typedef struct PatchJob {
+    VOBU *vobus;
+    int nb_vobus;
+    int first, last;    ///< the VOBU range [first, last)
+    int64_t base;       ///< input offset of the first VOBU of the file
+    int in;
+    PartFile *out;
+    int ret;
+    pthread_t thread;
+} PatchJob;
+
+/*
+ * Every VOBU lands at its input offset minus the data before the first
+ * NAV, so its NAV fields depend only on the index.
+ */
+static int patch_chunk(PatchJob *job, uint8_t *buf, int first, int last)
+{
+    int i, ret;
+
+    for (i = first; i < last; i++) {
+        VOBU *vobu   = job->vobus + i;
+        int64_t pos  = vobu->start - job->vobus[first].start;
+        int32_t len  = (vobu->end - vobu->start) / DVD_BLOCK_LEN - 1;
+        int32_t next = vobu->next == 0x3fffffff ? vobu->next : len + 1;
+        vobu_sri_t sri;
+        synci_t synci;
+
+        if ((ret = patch_nav(buf + pos, (vobu->start - job->base) / DVD_BLOCK_LEN,
+                             len, next)) < 0)
+            return ret;
+
+        build_vobu_sri(job->vobus, job->nb_vobus, i, &sri);
+        patch_vobu_sri(buf + pos, &sri);
+
+        build_vobu_synci(buf + pos, len + 1, &synci);
+        patch_vobu_synci(buf + pos, &synci);
+    }
 
     return 0;
 }
 
+static void *patch_worker(void *arg)
+{
+    PatchJob *job = arg;
+    uint8_t *buf  = NULL;
+    unsigned buf_size = 0;
+    int first = job->first;
+
+    while (first < job->last) {
+        VOBU *vobus  = job->vobus;
+        int last     = first + 1;
+        int64_t size;
+
+        while (last < job->last &&
+               vobus[last].end - vobus[first].start <= CHUNK_SIZE)
+            last++;
+
+        size = vobus[last - 1].end - vobus[first].start;
+
+        av_fast_malloc(&buf, &buf_size, size);
+        if (!buf) {
+            job->ret = AVERROR(ENOMEM);
+            break;
+        }
+
+        if ((job->ret = read_at(job->in, buf, size, vobus[first].start)) < 0)
+            break;
+
+        if (io_flags & IO_DONTNEED)
+            drop_cache(job->in, vobus[first].start, size);
+
+        if ((job->ret = patch_chunk(job, buf, first, last)) < 0)
+            break;
+
+        if ((job->ret = part_io(job->out, buf, size,
+                                vobus[first].start - job->base, 1)) < 0)
+            break;
+
+        first = last;
+    }
+
+    av_free(buf);
+
+    return NULL;
+}
+
+/*
+ * Split the index in ranges of about the same size and let each thread
+ * read, patch and write its own.
+ */
+static int patch_vob_parallel(const char *src, const char *dst, int nb_threads)
+{
+    VOBU *vobus = NULL;
+    PatchJob *jobs = NULL;
+    PartFile out = { { 0 } };
+    int64_t total, base;
+    int i, j, nb_vobus, in, nb_started = 0, ret = 0;
+
+    if ((nb_vobus = populate_vobs(&vobus, src)) < 0)
+        return nb_vobus;
+
+    in = open(src, O_RDONLY);
+    if (in < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s\n", src);
+        av_free(vobus);
+        return AVERROR(errno);
+    }
+
+    // The NAV fields are computed from the offsets, as with -i
+    for (i = 0; i < nb_vobus; i++) {
+        if (vobus[i].start % DVD_BLOCK_LEN ||
+            (i == nb_vobus - 1 && vobus[i].end % DVD_BLOCK_LEN)) {
+            av_log(NULL, AV_LOG_ERROR,
+                   "NAV at %"PRId64" is not sector aligned, "
+                   "rewrite the file instead\n", vobus[i].start);
+            ret = AVERROR_INVALIDDATA;
+            goto end;
+        }
+    }
+
+    base  = vobus[0].start;
+    total = vobus[nb_vobus - 1].end - base;
+
+    if ((ret = open_parts(&out, dst, O_WRONLY | O_CREAT | O_TRUNC,
+                          (total + PART_SIZE - 1) / PART_SIZE, total)) < 0)
+        goto end;
+
+    nb_threads = FFMIN(nb_threads, nb_vobus);
+    jobs = av_mallocz(nb_threads * sizeof(*jobs));
+    if (!jobs) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    for (i = 0, j = 0; i < nb_threads; i++) {
+        PatchJob *job = jobs + i;
+        int64_t limit = base + total * (i + 1) / nb_threads;
+
+        job->vobus    = vobus;
+        job->nb_vobus = nb_vobus;
+        job->base     = base;
+        job->in    = in;
+        job->out   = &out;
+        job->first = j;
+
+        while (j < nb_vobus && (vobus[j].start < limit || j == job->first))
+            j++;
+        job->last = i == nb_threads - 1 ? nb_vobus : j;
+
+        if (pthread_create(&job->thread, NULL, patch_worker, job)) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot start the thread %d\n", i);
+            ret = AVERROR(EAGAIN);
+            break;
+        }
+        nb_started++;
+    }
+
+    for (i = 0; i < nb_started; i++) {
+        pthread_join(jobs[i].thread, NULL);
+        if (jobs[i].ret < 0)
+            ret = jobs[i].ret;
+    }
+
+end:
+    close(in);
+    close_parts(&out);
+    av_free(jobs);
+    av_free(vobus);
+
+    return ret;
+}
+
+static const char *pipe_name(const char *name)
+{
+    return strcmp(name, "-") ? name : "pipe:";
+}
+
 int main(int argc, char *argv[])
 {
+    StreamContext s = { NULL };
     AVIOContext *in = NULL;
     VOBU *vobus = NULL;
-    int ret, i = 0, nb_vobus;
+    int ret = 0, i = 0, nb_vobus, c, stream = 0, segments = 0, in_place = 0;
+    int nb_threads = 0;
+    char *name = argv[0];
+    const char *update = NULL;
     av_register_all();
 
-    if (argc < 2)
-        help(argv[0]);
+    init_pack_filter(&filter);
 
-    ret = avio_open(&in, argv[1], AVIO_FLAG_READ);
+    while ((c = getopt(argc, argv, "SDsdiyptj:u:A:P:")) != -1) {
+        switch (c) {
+        case 't':
+            rebase = 1;
+            break;
+        case 'p':
+            filter.padding = compact = 1;
+            break;
+        case 'A':
+            if (parse_stream_list(filter.audio, 8, optarg) < 0)
+                return 1;
+            compact = 1;
+            break;
+        case 'P':
+            if (parse_stream_list(filter.subp, 32, optarg) < 0)
+                return 1;
+            compact = 1;
+            break;
+        case 'S':
+            split = 1;
+            break;
+        case 'D':
+            io_flags = IO_DIRECT | IO_DONTNEED;
+            break;
+        case 's':
+            stream = 1;
+            break;
+        case 'd':
+            segments = 1;
+            break;
+        case 'i':
+            in_place = 1;
+            break;
+        case 'y':
+            rebuild_synci = 1;
+            break;
+        case 'j':
+            nb_threads = atoi(optarg);
+            break;
+        case 'u':
+            update = optarg;
+            break;
+        default:
+            help(name);
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    // The other modes keep the sectors where the index puts them.
+    if ((compact || rebase) &&
+        ((!stream && !segments) || in_place || update || nb_threads > 0)) {
+        av_log(NULL, AV_LOG_ERROR, "-p, -t, -A and -P need -s or -d and "
+               "cannot be used with -i, -u or -j\n");
+        return 1;
+    }
+
+    if (in_place && argc > 1)
+        return patch_vob_in_place(argv[1]) < 0;
+
+    if (update && argc > 1) {
+        if (split) {
+            av_log(NULL, AV_LOG_ERROR, "-u works on the unified title\n");
+            return 1;
+        }
+        return update_vob(update, argv[1]) < 0;
+    }
+
+    if (argc < 3)
+        help(name);
+
+    if (nb_threads > 0)
+        return patch_vob_parallel(argv[1], argv[2], nb_threads) < 0;
+
+    if (!segments)
+        ret = open_file_io(&in, pipe_name(argv[1]), 0, 0, io_flags);
     if (ret < 0) {
         char errbuf[128];
         av_strerror(ret, errbuf, sizeof(errbuf));
@@ -134,21 +1300,72 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    nb_vobus = populate_vobs(&vobus, argv[1]);
+    out_name = pipe_name(argv[2]);
 
-    avio_open(&out, argv[2], AVIO_FLAG_WRITE);
+    // Every VOBU is copied as it is, the output size is known.
+    if (!segments && !stream) {
+        nb_vobus = populate_vobs(&vobus, argv[1]);
 
-    for (i = 0; i < nb_vobus; i++) {
-        ret = write_vob(vobus + i, in);
-        if (ret < 0) {
+        for (i = 0; i < nb_vobus; i++)
+            out_size += vobus[i].end - vobus[i].start;
+    }
+
+    ret = open_out_part();
+    if (ret < 0) {
+        char errbuf[128];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s: %s",
+               argv[2], errbuf);
+        return 1;
+    }
+
+    if (segments) {
+        if (open_inputs(&s, argv[1]) < 0)
+            exit(1);
+
+        ret = stream_vob(&s);
+        if (ret < 0)
             exit(1);
+
+        for (i = 0; i < s.nb_inputs; i++)
+            av_free(s.inputs[i]);
+        av_free(s.inputs);
+    } else if (stream) {
+        s.in = in;
+
+        ret = stream_vob(&s);
+        if (ret < 0)
+            exit(1);
+    } else {
+        for (i = 0; i < nb_vobus; i++) {
+            ret = write_vob(vobus, nb_vobus, i, in);
+            if (ret < 0) {
+                exit(1);
+            }
         }
     }
 
+    if (compact)
+        av_log(NULL, AV_LOG_INFO, "Dropped %"PRId64" packs\n",
+               dropped);
+
     av_free(vobus);
+    av_free(vobu_buf);
+
+    if (in)
+        close_file_io(&in);
+    if (close_file_io(&out) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot write %s\n", argv[2]);
+        return 1;
+    }
+
+    if (split && strcmp(out_name, "pipe:"))
+        remove_stale_parts(out_name, out_part + 1);
+
+    if ((segments || stream) && fill_forward_sri(s.index, s.nb_index) < 0)
+        return 1;
 
-    avio_close(in);
-    avio_close(out);
+    av_free(s.index);
 
     return 0;
 }
@@ -0,0 +1,232 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dvdread/dvd_reader.h>
+#include <dvdread/ifo_read.h>
+
+#include <libavformat/avio.h>
+#include <libavformat/avformat.h>
+#include <libavutil/intreadwrite.h>
+
+#include "common.h"
+
+// Pack and PES headers plus the muxer padding, in percent.
+#define MUX_OVERHEAD 3
+// DVD-Video maximum video bitrate, in kbit/s.
+#define MAX_VIDEO_RATE 9800
+
+static void help(char *name)
+{
+    fprintf(stderr, "%s <src_path> <vob_path> <target> [margin]\n"
+            "src_path:  The path to a dvd-video file layout, unencrypted\n"
+            "vob_path:  The path to the unified VOB files\n"
+            "target:    dvd5, dvd9 or the size in sectors\n"
+            "margin:    sectors to keep free, 0 by default\n",
+            name);
+    exit(0);
+}
+
+/*
+ * A segment is the unit dump_vobu writes and the encode stage consumes,
+ * a run of VOBUs sharing the same vob_id.
+ */
+typedef struct SEGMENT {
+    char name[64];
+    int title;
+    int copied;
+    int64_t video_sectors;
+    int64_t duration;
+} SEGMENT;
+
+typedef struct PlanContext {
+    SEGMENT *segments;
+    int nb_segments;
+    int64_t fixed_sectors;
+    int64_t video_sectors;
+} PlanContext;
+
+static int64_t file_sectors(const char *path)
+{
+    struct stat st;
+
+    // Menu VOBs can be omitted
+    if (stat(path, &st) < 0)
+        return 0;
+
+    return (st.st_size + DVD_BLOCK_LEN - 1) / DVD_BLOCK_LEN;
+}
+
+static SEGMENT *add_segment(PlanContext *p, int title, VOBU *vobu, int len)
+{
+    SEGMENT *s;
+
+    if (av_reallocp_array(&p->segments, p->nb_segments + 1,
+                          sizeof(*p->segments)) < 0)
+        return NULL;
+
+    s = p->segments + p->nb_segments++;
+    memset(s, 0, sizeof(*s));
+
+    snprintf(s->name, sizeof(s->name),
+             "0x%08"PRIx32"-0x%04"PRIx32"-0x%04"PRIx32"%s.vob",
+             vobu->start_sector,
+             vobu->dsi.dsi_gi.vobu_c_idn,
+             vobu->dsi.dsi_gi.vobu_vob_idn,
+             len ? "_d" : "_e");
+    s->title  = title;
+    s->copied = !len;
+
+    return s;
+}
+
+/*
+ * Account every sector of the title: the NAV packs, the audio and
+ * subpicture packs and the still VOBUs are copied as they are, only the
+ * video packs of the encoded segments are up for grabs.
+ */
+static int scan_title(PlanContext *p, const char *path, int title)
+{
+    AVIOContext *in = NULL;
+    VOBU vobu = { 0 };
+    SEGMENT *s = NULL;
+    uint8_t buf[DVD_BLOCK_LEN];
+    int32_t sector = 0, vobu_video = 0;
+    int ret, vob_idn = -1;
+
+    ret = avio_open(&in, path, AVIO_FLAG_READ);
+    if (ret < 0) {
+        char errbuf[128];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s: %s\n",
+               path, errbuf);
+        return ret;
+    }
+
+    while (avio_read(in, buf, sizeof(buf)) == sizeof(buf)) {
+        if (!parse_nav_sector(buf, &vobu) && vobu.vob_id) {
+            int len = vobu.dsi.dsi_gi.vobu_ea;
+
+            vobu.start_sector = sector;
+
+            if (vobu.vob_id != vob_idn) {
+                vob_idn = vobu.vob_id;
+                if (!(s = add_segment(p, title, &vobu, len)))
+                    return AVERROR(ENOMEM);
+            }
+
+            if (s->copied || !len)
+                p->fixed_sectors += len;
+            s->duration += vobu.pci.pci_gi.vobu_e_ptm -
+                           vobu.pci.pci_gi.vobu_s_ptm;
+            vobu_video = !s->copied && len;
+            p->fixed_sectors++;
+        } else if (!s) {
+            p->fixed_sectors++;
+        } else if (vobu_video) {
+            int id = pack_stream_id(buf, NULL);
+
+            if (id == VIDEO_STREAM) {
+                s->video_sectors++;
+                p->video_sectors++;
+            } else if (id != PADDING_STREAM) {
+                p->fixed_sectors++;
+            }
+        }
+        sector++;
+    }
+
+    avio_close(in);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    PlanContext p = { 0 };
+    dvd_reader_t *dvd;
+    ifo_handle_t *vmg;
+    const char *src_path, *vob_path;
+    char path[1024];
+    int64_t target, budget;
+    int i, ret, nb_titles;
+
+    av_register_all();
+
+    if (argc < 4)
+        help(argv[0]);
+
+    src_path = argv[1];
+    vob_path = argv[2];
+    target   = parse_target(argv[3]);
+    if (argc > 4)
+        target -= atoi(argv[4]);
+
+    dvd = DVDOpen(src_path);
+    if (!dvd) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the path %s\n", src_path);
+        return 1;
+    }
+
+    vmg = ifoOpen(dvd, 0);
+    if (!vmg) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the VMG in %s\n", src_path);
+        return 1;
+    }
+
+    nb_titles = vmg->vmgi_mat->vmg_nr_of_title_sets;
+
+    // IFO and BUP are written twice, the menus are copied over.
+    snprintf(path, sizeof(path), "%s/VIDEO_TS/VIDEO_TS.IFO", src_path);
+    p.fixed_sectors += 2 * file_sectors(path);
+    snprintf(path, sizeof(path), "%s/VIDEO_TS.VOB", vob_path);
+    p.fixed_sectors += file_sectors(path);
+
+    for (i = 1; i <= nb_titles; i++) {
+        snprintf(path, sizeof(path), "%s/VIDEO_TS/VTS_%02d_0.IFO",
+                 src_path, i);
+        p.fixed_sectors += 2 * file_sectors(path);
+        snprintf(path, sizeof(path), "%s/VTS_%02d_0.VOB", vob_path, i);
+        p.fixed_sectors += file_sectors(path);
+
+        snprintf(path, sizeof(path), "%s/VTS_%02d_1.VOB", vob_path, i);
+        if ((ret = scan_title(&p, path, i)) < 0)
+            return 1;
+    }
+
+    budget = (target - p.fixed_sectors) * (100 - MUX_OVERHEAD) / 100;
+
+    av_log(NULL, AV_LOG_INFO,
+           "target %"PRId64" fixed %"PRId64" video %"PRId64" -> %"PRId64"\n",
+           target, p.fixed_sectors, p.video_sectors, budget);
+
+    if (budget <= 0 || !p.video_sectors) {
+        av_log(NULL, AV_LOG_ERROR,
+               "No room left for the video, %"PRId64" sectors over\n",
+               -budget);
+        return 1;
+    }
+
+    for (i = 0; i < p.nb_segments; i++) {
+        SEGMENT *s = p.segments + i;
+        int64_t bits, rate;
+
+        if (s->copied || !s->video_sectors || !s->duration)
+            continue;
+
+        bits = budget * s->video_sectors / p.video_sectors *
+               DVD_BLOCK_LEN * 8;
+        rate = FFMIN(bits * 90 / s->duration, MAX_VIDEO_RATE);
+
+        printf("VTS_%02d_1/%s %"PRId64"\n", s->title, s->name, rate);
+    }
+
+    av_free(p.segments);
+    ifoClose(vmg);
+    DVDClose(dvd);
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+
+#include <libavformat/avio.h>
+#include <libavformat/avformat.h>
+
+#include "common.h"
+
+static void help(char *name)
+{
+    fprintf(stderr, "%s <path> [target]\n"
+            "path:   The path to a dvd-video file layout\n"
+            "target: dvd5, dvd9 or the size in sectors to check against\n",
+            name);
+    exit(0);
+}
+
+static void print_file(const char *name, int32_t sector, int64_t size)
+{
+    printf("%-16s 0x%08"PRIx32" %8"PRId32"\n",
+           name, sector, size_to_sectors(size));
+}
+
+/*
+ * One line per file in the order they are laid out on the disc, with
+ * the start sector and the length in sectors.
+ */
+static void print_title_set(const DiscLayout *l, int idx)
+{
+    const TitleSetLayout *ts = l->ts + idx;
+    int32_t sector           = ts->start_sector;
+    char name[16];
+
+    if (idx)
+        snprintf(name, sizeof(name), "VTS_%02d_0.IFO", idx);
+    else
+        snprintf(name, sizeof(name), "VIDEO_TS.IFO");
+    print_file(name, sector, ts->ifo_size);
+    sector += size_to_sectors(ts->ifo_size);
+
+    if (ts->menu_size) {
+        if (idx)
+            snprintf(name, sizeof(name), "VTS_%02d_0.VOB", idx);
+        else
+            snprintf(name, sizeof(name), "VIDEO_TS.VOB");
+        print_file(name, sector, ts->menu_size);
+        sector += size_to_sectors(ts->menu_size);
+    }
+
+    if (ts->title_size) {
+        snprintf(name, sizeof(name), "VTS_%02d_*.VOB", idx);
+        print_file(name, sector, ts->title_size);
+        sector += size_to_sectors(ts->title_size);
+    }
+
+    if (idx)
+        snprintf(name, sizeof(name), "VTS_%02d_0.BUP", idx);
+    else
+        snprintf(name, sizeof(name), "VIDEO_TS.BUP");
+    print_file(name, sector, ts->ifo_size);
+}
+
+int main(int argc, char **argv)
+{
+    DiscLayout layout;
+    int64_t target = 0;
+    int i;
+
+    if (argc < 2)
+        help(argv[0]);
+
+    if (argc > 2)
+        target = parse_target(argv[2]);
+
+    if (scan_disc_layout(&layout, argv[1]) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find VIDEO_TS.IFO in %s\n",
+               argv[1]);
+        return 1;
+    }
+
+    for (i = 0; i <= layout.nb_title_sets; i++)
+        print_title_set(&layout, i);
+
+    printf("%d title sets, %"PRId32" sectors\n",
+           layout.nb_title_sets, layout.nb_sectors);
+
+    if (target && layout.nb_sectors > target) {
+        av_log(NULL, AV_LOG_ERROR, "%"PRId64" sectors over the target\n",
+               layout.nb_sectors - target);
+        return 1;
+    }
+
+    return 0;
+}
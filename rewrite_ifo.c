@@ -1,6 +1,10 @@
+#include <pthread.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -8,6 +12,7 @@
 #include <dvdread/dvd_reader.h>
 #include <dvdread/ifo_read.h>
 
+#include <libavutil/avstring.h>
 #include <libavutil/intreadwrite.h>
 #include <libavformat/avio.h>
 #include <libavformat/avformat.h>
@@ -21,18 +26,6 @@ typedef struct PutBitContext {
     int size_in_bits;
 } PutBitContext;
 
-#define avio_seek(a, b, c)                                              \
-    do {                                                                \
-        int64_t _next = b;                                              \
-        int64_t _pos  = avio_tell(a);                                   \
-        av_log(NULL, AV_LOG_DEBUG | AV_LOG_C(214),                       \
-               "%s %d: Seek to 0x%08" PRIx64 " from 0x%08" PRIx64 "\n", \
-               __FUNCTION__,                                            \
-               __LINE__,                                                \
-               _next, _pos);                                            \
-        avio_seek(a, b, c);                                             \
-    } while (0)
-
 static inline void init_put_bits(PutBitContext *s, uint8_t *buffer,
                                  int buffer_size)
 {
@@ -106,20 +99,122 @@ static inline void flush_put_bits(PutBitContext *s)
     s->bit_buf  = 0;
 }
 
+/*
+ * The IFO image is built in memory, the gaps left by the seeks are zeroed,
+ * and written to disk in one go once its size is final.
+ */
+typedef struct IFOBuffer {
+    uint8_t *data;
+    int64_t pos;
+    int64_t size;       ///< the end of the furthest write
+    int64_t allocated;
+} IFOBuffer;
+
+static uint8_t *buf_reserve(IFOBuffer *b, int64_t n)
+{
+    int64_t end = b->pos + n;
+
+    if (end > b->allocated) {
+        int64_t allocated = FFMAX(end, 2 * b->allocated + DVD_BLOCK_LEN);
+        uint8_t *data     = av_realloc(b->data, allocated);
+
+        if (!data) {
+            av_log(NULL, AV_LOG_ERROR, "Not enough memory\n");
+            exit(1);
+        }
+
+        memset(data + b->allocated, 0, allocated - b->allocated);
+        b->data      = data;
+        b->allocated = allocated;
+    }
+
+    b->size = FFMAX(b->size, end);
+
+    return b->data + b->pos;
+}
+
+static void buf_seek(IFOBuffer *b, int64_t pos)
+{
+    b->pos = pos;
+}
+
+static int64_t buf_tell(IFOBuffer *b)
+{
+    return b->pos;
+}
+
+static void buf_write(IFOBuffer *b, const uint8_t *src, int64_t n)
+{
+    memcpy(buf_reserve(b, n), src, n);
+    b->pos += n;
+}
+
+static void buf_zero(IFOBuffer *b, int64_t n)
+{
+    memset(buf_reserve(b, n), 0, n);
+    b->pos += n;
+}
+
+static void buf_w8(IFOBuffer *b, uint8_t v)
+{
+    *buf_reserve(b, 1) = v;
+    b->pos += 1;
+}
+
+static void buf_wb16(IFOBuffer *b, uint16_t v)
+{
+    AV_WB16(buf_reserve(b, 2), v);
+    b->pos += 2;
+}
+
+static void buf_wb32(IFOBuffer *b, uint32_t v)
+{
+    AV_WB32(buf_reserve(b, 4), v);
+    b->pos += 4;
+}
+
+static void buf_wb64(IFOBuffer *b, uint64_t v)
+{
+    AV_WB64(buf_reserve(b, 8), v);
+    b->pos += 8;
+}
+
+static void buf_wl16(IFOBuffer *b, uint16_t v)
+{
+    AV_WL16(buf_reserve(b, 2), v);
+    b->pos += 2;
+}
+
+static void buf_wl32(IFOBuffer *b, uint32_t v)
+{
+    AV_WL32(buf_reserve(b, 4), v);
+    b->pos += 4;
+}
+
 static void help(char *name)
 {
-    fprintf(stderr, "%s <src_path> <dst_path> <index>\n"
+    fprintf(stderr, "%s [-m] [-A <list>] [-P <list>] <src_path> <dst_path> <index>\n"
+            "%s -a [-m] [-j <threads>] [-A <list>] [-P <list>] <src_path> <dst_path>\n"
             "src_path:  The path to a dvd-video file layout, unencrypted\n"
-            "dst_path:  The path to a dvd-video file layout, with unified VOB files.\n"
-            "index:     The index of the ifo to patch\n",
-            name);
+            "dst_path:  The path to a dvd-video file layout, with unified or\n"
+            "           split title VOB files.\n"
+            "index:     The index of the ifo to patch\n"
+            "-A:        The audio streams make_vob -A kept, e.g. 0,2\n"
+            "-P:        The subpicture streams make_vob -P kept\n"
+            "-a:        Rewrite all the IFOs and their BUP copies, the title\n"
+            "           sets in parallel and the VMG once they are done\n"
+            "-j:        The number of threads for -a, 4 by default\n"
+            "-m:        Patch only the sector fields of the IFO copied over,\n"
+            "           rewriting it if a table changes size\n",
+            name, name);
     exit(0);
 }
 
 typedef struct IFOContext {
     ifo_handle_t *i;
-    AVIOContext *pb;
+    IFOBuffer pb;
     int64_t ifo_size;
+    DiscLayout *layout;
 } IFOContext;
 
 IFOContext *ifo_alloc(void)
@@ -145,117 +240,67 @@ static int64_t ifo_size(const char *path, int idx)
     return st.st_size;
 }
 
-static int64_t menu_size(const char *path, int idx)
+static void ifo_path(char *path, int size, const char *dst,
+                     const char *ext, int idx)
 {
-    char menu_path[1024];
-    struct stat st;
-
-    if (!idx) {
-        snprintf(menu_path, sizeof(menu_path),
-                 "%s/VIDEO_TS/%s.VOB", path, "VIDEO_TS");
-    } else {
-        snprintf(menu_path, sizeof(menu_path),
-                 "%s/VIDEO_TS/VTS_%02d_0.VOB", path, idx);
-    }
-
-    // Menu VOBs can be omitted
-    if (stat(menu_path, &st) < 0)
-        return 0;
-
-    return st.st_size;
-}
-
-static int64_t title_size(const char *path, int idx)
-{
-    char title_path[1024];
-    struct stat st;
     if (!idx)
-        return 0;
-
-    snprintf(title_path, sizeof(title_path),
-             "%s/VIDEO_TS/VTS_%02d_1.VOB", path, idx);
-
-    stat(title_path, &st);
-
-    return st.st_size;
-}
-
-static int to_sector(int64_t size)
-{
-    return (size + DVD_BLOCK_LEN - 1) / DVD_BLOCK_LEN;
+        snprintf(path, size, "%s/VIDEO_TS/%s.%s", dst, "VIDEO_TS", ext);
+    else
+        snprintf(path, size, "%s/VIDEO_TS/VTS_%02d_0.%s", dst, idx, ext);
 }
 
-static int title_set_sector(const char *dst, int idx)
+/*
+ * Replace the file with the IFO image with a single write.
+ */
+static int ifo_store(IFOContext *ifo, const char *dst, const char *ext,
+                     int idx)
 {
-    int ifo_sector   = to_sector(ifo_size(dst, idx));
-    int menu_sector  = to_sector(menu_size(dst, idx));
-    int title_sector = to_sector(title_size(dst, idx));
-
-    av_log(NULL, AV_LOG_DEBUG|AV_LOG_C(211),
-           "ifo 0x%08d menu 0x%08d title 0x%08d\n",
-           ifo_sector,
-           menu_sector,
-           title_sector);
-    return 2 * ifo_sector + menu_sector + title_sector;
-}
+    char path[1024];
+    int fd, ret;
 
-static int ifo_open_internal(AVIOContext **pb,
-                             const char *path,
-                             const char *ext,
-                             int idx,
-                             int rw)
-{
-    char ifo_path[1024];
+    ifo_path(path, sizeof(path), dst, ext, idx);
 
-    if (!idx) {
-        snprintf(ifo_path, sizeof(ifo_path),
-                 "%s/VIDEO_TS/%s.%s", path, "VIDEO_TS", ext);
-    } else {
-        snprintf(ifo_path, sizeof(ifo_path),
-                 "%s/VIDEO_TS/VTS_%02d_0.%s", path, idx, ext);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open %s\n", path);
+        return AVERROR(errno);
     }
 
-    return avio_open(pb, ifo_path, rw);
-}
+    ret = write_at(fd, ifo->pb.data, ifo->pb.size, 0);
+    if (ret < 0)
+        av_log(NULL, AV_LOG_ERROR, "Cannot write %s\n", path);
 
-static int ifo_open(IFOContext **ifo,
-                    const char *path,
-                    int idx,
-                    int rw)
-{
-    *ifo = ifo_alloc();
-    if (!ifo)
-        return AVERROR(ENOMEM);
+    close(fd);
 
-    return ifo_open_internal(&(*ifo)->pb, path, "IFO", idx, rw);
+    return ret;
 }
 
-static void ifo_write_vts_ptt_srp(AVIOContext *pb, int offset,
+static void ifo_write_vts_ptt_srp(IFOBuffer *pb, int offset,
                                   vts_ptt_srpt_t *srpt)
 {
     int i, map_size;
 
     map_size = (srpt->last_byte + 1 - TT_SRPT_SIZE) / sizeof(int32_t);
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb16(pb, srpt->nr_of_srpts);
-    avio_wb16(pb, 0);
-    avio_wb32(pb, srpt->last_byte);
+    buf_wb16(pb, srpt->nr_of_srpts);
+    buf_wb16(pb, 0);
+    buf_wb32(pb, srpt->last_byte);
 
     for (i = 0; i < srpt->nr_of_srpts; i++) //FIXME HACK!!!
-        avio_wb32(pb, srpt->ttu_offset[i]);
+        buf_wb32(pb, srpt->ttu_offset[i]);
 
     for (; i < map_size; i++)
-        avio_wl32(pb, srpt->ttu_offset[i]);
+        buf_wl32(pb, srpt->ttu_offset[i]);
 }
 
-static void write_pgci_srp(AVIOContext *pb, pgci_srp_t *pgci)
+static void write_pgci_srp(IFOBuffer *pb, pgci_srp_t *pgci)
 {
     uint8_t block = pgci->block_mode << 6 | pgci->block_type << 4;
-    avio_w8(pb, pgci->entry_id);
-    avio_w8(pb, block);
-    avio_wb16(pb, pgci->ptl_id_mask);
-    avio_wb32(pb, pgci->pgc_start_byte);
+    buf_w8(pb, pgci->entry_id);
+    buf_w8(pb, block);
+    buf_wb16(pb, pgci->ptl_id_mask);
+    buf_wb32(pb, pgci->pgc_start_byte);
 }
 
 typedef struct PGCContext {
@@ -263,15 +308,15 @@ typedef struct PGCContext {
     pgc_t *pgc;
 } PGCContext;
 
-static void write_dvd_time(AVIOContext *pb, dvd_time_t *time)
+static void write_dvd_time(IFOBuffer *pb, dvd_time_t *time)
 {
-    avio_w8(pb, time->hour);
-    avio_w8(pb, time->minute);
-    avio_w8(pb, time->second);
-    avio_w8(pb, time->frame_u);
+    buf_w8(pb, time->hour);
+    buf_w8(pb, time->minute);
+    buf_w8(pb, time->second);
+    buf_w8(pb, time->frame_u);
 }
 
-static void write_user_ops(AVIOContext *pb, user_ops_t *ops)
+static void write_user_ops(IFOBuffer *pb, user_ops_t *ops)
 {
     PutBitContext s;
     uint8_t buf[sizeof(*ops)];
@@ -307,41 +352,41 @@ static void write_user_ops(AVIOContext *pb, user_ops_t *ops)
 
     flush_put_bits(&s);
 
-    avio_write(pb, buf, sizeof(buf));
+    buf_write(pb, buf, sizeof(buf));
 }
 
-static void write_command_tbl(AVIOContext *pb, int64_t offset,
+static void write_command_tbl(IFOBuffer *pb, int64_t offset,
                               pgc_command_tbl_t *cmd_tbl)
 {
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb16(pb, cmd_tbl->nr_of_pre);
-    avio_wb16(pb, cmd_tbl->nr_of_post);
-    avio_wb16(pb, cmd_tbl->nr_of_cell);
-    avio_wl16(pb, cmd_tbl->zero_1); //FIXME HACKISH
+    buf_wb16(pb, cmd_tbl->nr_of_pre);
+    buf_wb16(pb, cmd_tbl->nr_of_post);
+    buf_wb16(pb, cmd_tbl->nr_of_cell);
+    buf_wl16(pb, cmd_tbl->zero_1); //FIXME HACKISH
 
     if (cmd_tbl->nr_of_pre)
-        avio_write(pb, (uint8_t *)cmd_tbl->pre_cmds,
+        buf_write(pb, (uint8_t *)cmd_tbl->pre_cmds,
                    cmd_tbl->nr_of_pre * COMMAND_DATA_SIZE);
 
     if (cmd_tbl->nr_of_post)
-        avio_write(pb, (uint8_t *)cmd_tbl->post_cmds,
+        buf_write(pb, (uint8_t *)cmd_tbl->post_cmds,
                    cmd_tbl->nr_of_post * COMMAND_DATA_SIZE);
 
     if (cmd_tbl->nr_of_cell)
-        avio_write(pb, (uint8_t *)cmd_tbl->cell_cmds,
+        buf_write(pb, (uint8_t *)cmd_tbl->cell_cmds,
                    cmd_tbl->nr_of_cell * COMMAND_DATA_SIZE);
 }
 
-static void write_pgc_program_map(AVIOContext *pb, int64_t offset,
+static void write_pgc_program_map(IFOBuffer *pb, int64_t offset,
                                   int nb, pgc_program_map_t *map)
 {
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_write(pb, map, nb * sizeof(*map));
+    buf_write(pb, map, nb * sizeof(*map));
 }
 
-static void write_cell_playback_internal(AVIOContext *pb,
+static void write_cell_playback_internal(IFOBuffer *pb,
                                          cell_playback_t *cell)
 {
     PutBitContext s;
@@ -361,74 +406,74 @@ static void write_cell_playback_internal(AVIOContext *pb,
 
     flush_put_bits(&s);
 
-    avio_write(pb, buf, sizeof(buf));
+    buf_write(pb, buf, sizeof(buf));
 
-    avio_w8(pb, cell->still_time);
-    avio_w8(pb, cell->cell_cmd_nr);
+    buf_w8(pb, cell->still_time);
+    buf_w8(pb, cell->cell_cmd_nr);
     write_dvd_time(pb, &cell->playback_time);
 
-    avio_wb32(pb, cell->first_sector);
-    avio_wb32(pb, cell->first_ilvu_end_sector);
-    avio_wb32(pb, cell->last_vobu_start_sector);
-    avio_wb32(pb, cell->last_sector);
+    buf_wb32(pb, cell->first_sector);
+    buf_wb32(pb, cell->first_ilvu_end_sector);
+    buf_wb32(pb, cell->last_vobu_start_sector);
+    buf_wb32(pb, cell->last_sector);
 }
 
-static void write_cell_playback(AVIOContext *pb, int64_t offset,
+static void write_cell_playback(IFOBuffer *pb, int64_t offset,
                                 int nb, cell_playback_t *cell)
 {
     int i;
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
     for (i = 0; i < nb; i++)
         write_cell_playback_internal(pb, cell + i);
 }
-static void write_cell_position(AVIOContext *pb, int64_t offset,
+static void write_cell_position(IFOBuffer *pb, int64_t offset,
                                 int nb, cell_position_t *cell)
 {
     int i;
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
     for (i = 0; i < nb; i++) {
-        avio_wb16(pb, cell[i].vob_id_nr);
-        avio_w8(pb, 0);
-        avio_w8(pb, cell[i].cell_nr);
+        buf_wb16(pb, cell[i].vob_id_nr);
+        buf_w8(pb, 0);
+        buf_w8(pb, cell[i].cell_nr);
     }
 }
 
-static void write_pgc(AVIOContext *pb, int64_t offset, pgc_t *pgc)
+static void write_pgc(IFOBuffer *pb, int64_t offset, pgc_t *pgc)
 {
     int i;
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb16(pb, 0);
-    avio_w8(pb, pgc->nr_of_programs);
-    avio_w8(pb, pgc->nr_of_cells);
+    buf_wb16(pb, 0);
+    buf_w8(pb, pgc->nr_of_programs);
+    buf_w8(pb, pgc->nr_of_cells);
 
     write_dvd_time(pb, &pgc->playback_time);
     write_user_ops(pb, &pgc->prohibited_ops);
 
     for (i = 0; i < 8; i++)
-        avio_wb16(pb, pgc->audio_control[i]);
+        buf_wb16(pb, pgc->audio_control[i]);
 
     for (i = 0; i < 32; i++)
-        avio_wb32(pb, pgc->subp_control[i]);
+        buf_wb32(pb, pgc->subp_control[i]);
 
-    avio_wb16(pb, pgc->next_pgc_nr);
-    avio_wb16(pb, pgc->prev_pgc_nr);
-    avio_wb16(pb, pgc->goup_pgc_nr);
+    buf_wb16(pb, pgc->next_pgc_nr);
+    buf_wb16(pb, pgc->prev_pgc_nr);
+    buf_wb16(pb, pgc->goup_pgc_nr);
 
-    avio_w8(pb, pgc->still_time);
-    avio_w8(pb, pgc->pg_playback_mode);
+    buf_w8(pb, pgc->still_time);
+    buf_w8(pb, pgc->pg_playback_mode);
 
     for (i = 0; i < 16; i++)
-        avio_wb32(pb, pgc->palette[i]);
+        buf_wb32(pb, pgc->palette[i]);
 
-    avio_wb16(pb, pgc->command_tbl_offset);
-    avio_wb16(pb, pgc->program_map_offset);
-    avio_wb16(pb, pgc->cell_playback_offset);
-    avio_wb16(pb, pgc->cell_position_offset);
+    buf_wb16(pb, pgc->command_tbl_offset);
+    buf_wb16(pb, pgc->program_map_offset);
+    buf_wb16(pb, pgc->cell_playback_offset);
+    buf_wb16(pb, pgc->cell_position_offset);
 
     if (pgc->command_tbl)
         write_command_tbl(pb, offset + pgc->command_tbl_offset,
@@ -449,15 +494,15 @@ static void write_pgc(AVIOContext *pb, int64_t offset, pgc_t *pgc)
 }
 
 
-static void ifo_write_pgcit(AVIOContext *pb, int64_t offset,
+static void ifo_write_pgcit(IFOBuffer *pb, int64_t offset,
                             pgcit_t *pgcit)
 {
     int i; //, nb_pgc;
 
-    avio_seek(pb, offset, SEEK_SET);
-    avio_wb16(pb, pgcit->nr_of_pgci_srp);
-    avio_wb16(pb, 0);
-    avio_wb32(pb, pgcit->last_byte);
+    buf_seek(pb, offset);
+    buf_wb16(pb, pgcit->nr_of_pgci_srp);
+    buf_wb16(pb, 0);
+    buf_wb32(pb, pgcit->last_byte);
 
     for (i = 0; i < pgcit->nr_of_pgci_srp; i++)
          write_pgci_srp(pb, pgcit->pgci_srp + i);
@@ -467,7 +512,7 @@ static void ifo_write_pgcit(AVIOContext *pb, int64_t offset,
                    pgcit->pgci_srp[i].pgc);
 }
 
-static void write_audio_attr(AVIOContext *pb, audio_attr_t *attr)
+static void write_audio_attr(IFOBuffer *pb, audio_attr_t *attr)
 {
     uint8_t buffer[sizeof(*attr)];
     PutBitContext s;
@@ -497,10 +542,10 @@ static void write_audio_attr(AVIOContext *pb, audio_attr_t *attr)
 
     flush_put_bits(&s);
 
-    avio_write(pb, buffer, sizeof(*attr));
+    buf_write(pb, buffer, sizeof(*attr));
 }
 
-static void write_subp_attr(AVIOContext *pb, subp_attr_t *attr)
+static void write_subp_attr(IFOBuffer *pb, subp_attr_t *attr)
 {
     uint8_t buffer;
     PutBitContext s;
@@ -511,15 +556,15 @@ static void write_subp_attr(AVIOContext *pb, subp_attr_t *attr)
     put_bits(&s, 2, attr->type);
 
     flush_put_bits(&s);
-    avio_w8(pb, buffer);
+    buf_w8(pb, buffer);
 
-    avio_w8(pb, 0);
-    avio_wb16(pb, attr->lang_code);
-    avio_w8(pb, attr->lang_extension);
-    avio_w8(pb, attr->code_extension);
+    buf_w8(pb, 0);
+    buf_wb16(pb, attr->lang_code);
+    buf_w8(pb, attr->lang_extension);
+    buf_w8(pb, attr->code_extension);
 }
 
-static void write_video_attr(AVIOContext *pb, video_attr_t *attr)
+static void write_video_attr(IFOBuffer *pb, video_attr_t *attr)
 {
     uint8_t buffer[sizeof(*attr)];
     PutBitContext s;
@@ -540,10 +585,10 @@ static void write_video_attr(AVIOContext *pb, video_attr_t *attr)
 
     flush_put_bits(&s);
 
-    avio_write(pb, buffer, sizeof(*attr));
+    buf_write(pb, buffer, sizeof(*attr));
 }
 
-static void write_multichannel_ext(AVIOContext *pb, multichannel_ext_t *ext)
+static void write_multichannel_ext(IFOBuffer *pb, multichannel_ext_t *ext)
 {
     unsigned int i;
     uint8_t buffer[sizeof(*ext)];
@@ -580,33 +625,33 @@ static void write_multichannel_ext(AVIOContext *pb, multichannel_ext_t *ext)
 
     flush_put_bits(&s);
 
-    avio_write(pb, buffer, sizeof(*ext));
+    buf_write(pb, buffer, sizeof(*ext));
 }
 
-static void write_pgci_lu(AVIOContext *pb, int64_t offset, pgci_lu_t *lu)
+static void write_pgci_lu(IFOBuffer *pb, int64_t offset, pgci_lu_t *lu)
 {
     int64_t pos;
 
-    avio_wb16(pb, lu->lang_code);
-    avio_w8(pb, lu->lang_extension);
-    avio_w8(pb, lu->exists);
-    avio_wb32(pb, lu->lang_start_byte);
+    buf_wb16(pb, lu->lang_code);
+    buf_w8(pb, lu->lang_extension);
+    buf_w8(pb, lu->exists);
+    buf_wb32(pb, lu->lang_start_byte);
 
-    pos = avio_tell(pb);
+    pos = buf_tell(pb);
     ifo_write_pgcit(pb, offset + lu->lang_start_byte, lu->pgcit);
-    avio_seek(pb, pos, SEEK_SET);
+    buf_seek(pb, pos);
 }
 
-static void ifo_write_pgci_ut(AVIOContext *pb, int64_t offset,
+static void ifo_write_pgci_ut(IFOBuffer *pb, int64_t offset,
                               pgci_ut_t *pgci_ut)
 {
     int i;
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb16(pb, pgci_ut->nr_of_lus);
-    avio_wb16(pb, 0);
-    avio_wb32(pb, pgci_ut->last_byte);
+    buf_wb16(pb, pgci_ut->nr_of_lus);
+    buf_wb16(pb, 0);
+    buf_wb32(pb, pgci_ut->last_byte);
 
     for (i = 0; i < pgci_ut->nr_of_lus; i++)
         write_pgci_lu(pb, offset, pgci_ut->lu + i);
@@ -619,216 +664,190 @@ void patch_cell_playback(cell_playback_t *cell_playback, CELL *cell)
     cell_playback->last_vobu_start_sector = cell->last_vobu_start_sector;
 }
 
-CELL *match_cell(CELL *cells, int nb_cells, int vob_id, int cell_id)
-{
-    int i;
-
-    for (i = 0; i < nb_cells; i++) {
-        if (cells[i].vob_id == vob_id &&
-            cells[i].cell_id == cell_id)
-            return cells + i;
-    }
-
-    av_log(NULL, AV_LOG_ERROR, "Cannot find cell %d-%d\n",
-           vob_id, cell_id);
-
-    return NULL;
-}
-
-static void patch_pgc(pgc_t *pgc, CELL *cells, int nb_cells)
+/*
+ * The cells not found are collected in the index and reported once
+ * the whole table had been patched.
+ */
+static void patch_pgc(pgc_t *pgc, CellIndex *ci)
 {
     int i, missing_cell = 0;
     if (!pgc->cell_playback)
         return;
 
     for (i = 0; i < pgc->nr_of_cells; i++) {
-        CELL *cell = match_cell(cells, nb_cells,
-                                pgc->cell_position[i].vob_id_nr,
-                                pgc->cell_position[i].cell_nr);
+        CELL *cell = find_cell(ci, pgc->cell_position[i].vob_id_nr,
+                               pgc->cell_position[i].cell_nr);
         if (cell)
             patch_cell_playback(pgc->cell_playback + i, cell);
         else
             missing_cell++;
     }
-    if (missing_cell > 1) {
-        av_log(NULL, AV_LOG_ERROR, "Missing %d cells, aborting.\n",
-               missing_cell);
-    }
     pgc->nr_of_cells -= missing_cell;
 }
 
-static void patch_pgcit(pgcit_t *pgcit, CELL *cells, int nb_cells)
+static void patch_pgcit(pgcit_t *pgcit, CellIndex *ci)
 {
     int i;
 
     for (i = 0; i < pgcit->nr_of_pgci_srp; i++)
-        patch_pgc(pgcit->pgci_srp[i].pgc, cells, nb_cells);
+        patch_pgc(pgcit->pgci_srp[i].pgc, ci);
 }
 
-static void patch_pgci_lu(pgci_lu_t *lu, CELL *cells, int nb_cells)
+static void patch_pgci_lu(pgci_lu_t *lu, CellIndex *ci)
 {
-    patch_pgcit(lu->pgcit, cells, nb_cells);
+    patch_pgcit(lu->pgcit, ci);
 }
 
-static void patch_pgci_ut(pgci_ut_t *pgci_ut, CELL *cells, int nb_cells)
+static void patch_pgci_ut(pgci_ut_t *pgci_ut, CellIndex *ci)
 {
     int i;
 
     for (i = 0; i < pgci_ut->nr_of_lus; i++)
-        patch_pgci_lu(pgci_ut->lu + i, cells, nb_cells);
+        patch_pgci_lu(pgci_ut->lu + i, ci);
 }
 
 
-static void write_tmap(AVIOContext *pb, int64_t offset,
+static void write_tmap(IFOBuffer *pb, int64_t offset,
                        vts_tmap_t *tmap)
 {
     int i;
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_w8(pb, tmap->tmu);
-    avio_w8(pb, 0);
-    avio_wb16(pb, tmap->nr_of_entries);
+    buf_w8(pb, tmap->tmu);
+    buf_w8(pb, 0);
+    buf_wb16(pb, tmap->nr_of_entries);
 
     for (i = 0; i < tmap->nr_of_entries; i++)
-        avio_wb32(pb, tmap->map_ent[i]);
+        buf_wb32(pb, tmap->map_ent[i]);
 }
 
-static void ifo_write_vts_tmapt(AVIOContext *pb, int64_t offset,
+static void ifo_write_vts_tmapt(IFOBuffer *pb, int64_t offset,
                                 vts_tmapt_t *vts_tmapt)
 {
     int i;
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb16(pb, vts_tmapt->nr_of_tmaps);
-    avio_wb16(pb, 0);
-    avio_wb32(pb, vts_tmapt->last_byte);
+    buf_wb16(pb, vts_tmapt->nr_of_tmaps);
+    buf_wb16(pb, 0);
+    buf_wb32(pb, vts_tmapt->last_byte);
 
     for (i = 0; i < vts_tmapt->nr_of_tmaps; i++)
-        avio_wb32(pb, vts_tmapt->tmap_offset[i]);
+        buf_wb32(pb, vts_tmapt->tmap_offset[i]);
 
     for (i = 0; i < vts_tmapt->nr_of_tmaps; i++)
         write_tmap(pb, offset + vts_tmapt->tmap_offset[i],
                    vts_tmapt->tmap + i);
 }
 
-static void ifo_write_c_adt(AVIOContext *pb, int64_t offset,
+static void ifo_write_c_adt(IFOBuffer *pb, int64_t offset,
                             c_adt_t *c_adt)
 {
     int i, map_size;
 
     map_size = (c_adt->last_byte + 1 - C_ADT_SIZE) / sizeof(cell_adr_t);
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb16(pb, c_adt->nr_of_vobs);
-    avio_wb16(pb, 0);
-    avio_wb32(pb, c_adt->last_byte);
+    buf_wb16(pb, c_adt->nr_of_vobs);
+    buf_wb16(pb, 0);
+    buf_wb32(pb, c_adt->last_byte);
 
     for (i = 0; i < map_size; i++) {
-        avio_wb16(pb, c_adt->cell_adr_table[i].vob_id);
-        avio_w8(pb, c_adt->cell_adr_table[i].cell_id);
-        avio_w8(pb, 0);
-        avio_wb32(pb, c_adt->cell_adr_table[i].start_sector);
-        avio_wb32(pb, c_adt->cell_adr_table[i].last_sector);
+        buf_wb16(pb, c_adt->cell_adr_table[i].vob_id);
+        buf_w8(pb, c_adt->cell_adr_table[i].cell_id);
+        buf_w8(pb, 0);
+        buf_wb32(pb, c_adt->cell_adr_table[i].start_sector);
+        buf_wb32(pb, c_adt->cell_adr_table[i].last_sector);
     }
 }
 
-static void ifo_write_vobu_admap(AVIOContext *pb, int64_t offset,
+static void ifo_write_vobu_admap(IFOBuffer *pb, int64_t offset,
                                  vobu_admap_t *vobu_admap)
 {
     int i, map_size;
 
     map_size = (vobu_admap->last_byte + 1 - VOBU_ADMAP_SIZE) / sizeof(uint32_t);
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb32(pb, vobu_admap->last_byte);
+    buf_wb32(pb, vobu_admap->last_byte);
 
     for (i = 0; i < map_size; i++)
-        avio_wb32(pb, vobu_admap->vobu_start_sectors[i]);
+        buf_wb32(pb, vobu_admap->vobu_start_sectors[i]);
 }
 
 static int ifo_write_vts(IFOContext *ifo)
 {
-    AVIOContext *pb  = ifo->pb;
+    IFOBuffer *pb    = &ifo->pb;
     vtsi_mat_t *vtsi = ifo->i->vtsi_mat;
     int i;
 
-    avio_printf(ifo->pb, "%s", "DVDVIDEO-VTS");
+    buf_write(pb, (const uint8_t *)"DVDVIDEO-VTS", 12);
 
-    avio_wb32(pb, vtsi->vts_last_sector);
-    for (i = 0; i < 12; i++)
-        avio_w8(pb, 0);
+    buf_wb32(pb, vtsi->vts_last_sector);
+    buf_zero(pb, 12);
 
-    avio_wb32(pb, vtsi->vtsi_last_sector);
-    avio_w8(pb, 0);
-    avio_w8(pb, vtsi->specification_version);
-    avio_wb32(pb, vtsi->vts_category);
+    buf_wb32(pb, vtsi->vtsi_last_sector);
+    buf_w8(pb, 0);
+    buf_w8(pb, vtsi->specification_version);
+    buf_wb32(pb, vtsi->vts_category);
 
-    for (i = 0; i < 2 + 2 + 1 + 19 + 2 + 32 + 8 + 24; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 2 + 2 + 1 + 19 + 2 + 32 + 8 + 24);
 
-    avio_wb32(pb, vtsi->vtsi_last_byte);
+    buf_wb32(pb, vtsi->vtsi_last_byte);
 
 
-    for (i = 0; i < 4 + 56; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 4 + 56);
 
 
-    avio_wb32(pb, vtsi->vtsm_vobs);
-    avio_wb32(pb, vtsi->vtstt_vobs);
-    avio_wb32(pb, vtsi->vts_ptt_srpt);
-    avio_wb32(pb, vtsi->vts_pgcit);
-    avio_wb32(pb, vtsi->vtsm_pgci_ut);
-    avio_wb32(pb, vtsi->vts_tmapt);
-    avio_wb32(pb, vtsi->vtsm_c_adt);
-    avio_wb32(pb, vtsi->vtsm_vobu_admap);
-    avio_wb32(pb, vtsi->vts_c_adt);
-    avio_wb32(pb, vtsi->vts_vobu_admap);
+    buf_wb32(pb, vtsi->vtsm_vobs);
+    buf_wb32(pb, vtsi->vtstt_vobs);
+    buf_wb32(pb, vtsi->vts_ptt_srpt);
+    buf_wb32(pb, vtsi->vts_pgcit);
+    buf_wb32(pb, vtsi->vtsm_pgci_ut);
+    buf_wb32(pb, vtsi->vts_tmapt);
+    buf_wb32(pb, vtsi->vtsm_c_adt);
+    buf_wb32(pb, vtsi->vtsm_vobu_admap);
+    buf_wb32(pb, vtsi->vts_c_adt);
+    buf_wb32(pb, vtsi->vts_vobu_admap);
 
 
-    for (i = 0; i < 24; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 24);
 
     write_video_attr(pb, &vtsi->vtsm_video_attr);
-    avio_w8(pb, 0);
+    buf_w8(pb, 0);
 
 
-    avio_w8(pb, vtsi->nr_of_vtsm_audio_streams);
+    buf_w8(pb, vtsi->nr_of_vtsm_audio_streams);
     write_audio_attr(pb, &vtsi->vtsm_audio_attr);
-    for (i = 0; i < 7 * sizeof(audio_attr_t); i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 7 * sizeof(audio_attr_t));
 
-    for (i = 0; i < 17; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 17);
 
 
-    avio_w8(pb, vtsi->nr_of_vtsm_subp_streams);
+    buf_w8(pb, vtsi->nr_of_vtsm_subp_streams);
     write_subp_attr(pb, &vtsi->vtsm_subp_attr);
-    for (i = 0; i < 27 * sizeof(subp_attr_t); i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 27 * sizeof(subp_attr_t));
 
-    for (i = 0; i < 2; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 2);
 
     write_video_attr(pb, &vtsi->vts_video_attr);
-    avio_w8(pb, 0);
+    buf_w8(pb, 0);
 
-    avio_w8(pb, vtsi->nr_of_vts_audio_streams);
+    buf_w8(pb, vtsi->nr_of_vts_audio_streams);
     for (i = 0; i < 8; i++)
         write_audio_attr(pb, vtsi->vts_audio_attr + i);
 
-    for (i = 0; i < 17; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 17);
 
 
-    avio_w8(pb, vtsi->nr_of_vts_subp_streams);
+    buf_w8(pb, vtsi->nr_of_vts_subp_streams);
     for (i = 0; i < 32; i++)
         write_subp_attr(pb, vtsi->vts_subp_attr + i);
 
-    avio_wb16(pb, 0);
+    buf_wb16(pb, 0);
 
     for (i = 0; i < 8; i++)
         write_multichannel_ext(pb, vtsi->vts_mu_audio_attr + i);
@@ -864,7 +883,7 @@ static int ifo_write_vts(IFOContext *ifo)
     return 0;
 }
 
-static void write_playback_type(AVIOContext *pb,
+static void write_playback_type(IFOBuffer *pb,
                                 playback_type_t *pt)
 {
     PutBitContext s;
@@ -882,43 +901,43 @@ static void write_playback_type(AVIOContext *pb,
 
     flush_put_bits(&s);
 
-    avio_write(pb, buf, sizeof(buf));
+    buf_write(pb, buf, sizeof(buf));
 }
 
-static void write_tt_srpt(AVIOContext *pb, int64_t offset,
+static void write_tt_srpt(IFOBuffer *pb, int64_t offset,
                           tt_srpt_t *tt_srpt)
 {
     int i, map_size;
 
     map_size = (tt_srpt->last_byte + 1 - TT_SRPT_SIZE) / sizeof(title_info_t);
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb16(pb, tt_srpt->nr_of_srpts);
-    avio_wb16(pb, 0);
-    avio_wb32(pb, tt_srpt->last_byte);
+    buf_wb16(pb, tt_srpt->nr_of_srpts);
+    buf_wb16(pb, 0);
+    buf_wb32(pb, tt_srpt->last_byte);
 
     for (i = 0; i < map_size; i++) {
         write_playback_type(pb, &tt_srpt->title[i].pb_ty);
-        avio_w8(pb, tt_srpt->title[i].nr_of_angles);
-        avio_wb16(pb, tt_srpt->title[i].nr_of_ptts);
-        avio_wb16(pb, tt_srpt->title[i].parental_id);
-        avio_w8(pb, tt_srpt->title[i].title_set_nr);
-        avio_w8(pb, tt_srpt->title[i].vts_ttn);
-        avio_wb32(pb, tt_srpt->title[i].title_set_sector);
+        buf_w8(pb, tt_srpt->title[i].nr_of_angles);
+        buf_wb16(pb, tt_srpt->title[i].nr_of_ptts);
+        buf_wb16(pb, tt_srpt->title[i].parental_id);
+        buf_w8(pb, tt_srpt->title[i].title_set_nr);
+        buf_w8(pb, tt_srpt->title[i].vts_ttn);
+        buf_wb32(pb, tt_srpt->title[i].title_set_sector);
     }
 }
 
-static void write_ptl_mait_country(AVIOContext *pb,
+static void write_ptl_mait_country(IFOBuffer *pb,
                                    ptl_mait_country_t *country)
 {
-    avio_wb16(pb, country->country_code);
-    avio_wb16(pb, 0);
-    avio_wb16(pb, country->pf_ptl_mai_start_byte);
-    avio_wb16(pb, 0);
+    buf_wb16(pb, country->country_code);
+    buf_wb16(pb, 0);
+    buf_wb16(pb, country->pf_ptl_mai_start_byte);
+    buf_wb16(pb, 0);
 }
 
-static void write_pf_level(AVIOContext *pb, int64_t offset,
+static void write_pf_level(IFOBuffer *pb, int64_t offset,
                            pf_level_t *pf,
                            int nr_of_vtss)
 {
@@ -929,7 +948,7 @@ static void write_pf_level(AVIOContext *pb, int64_t offset,
 
     pf_temp = av_malloc(map_size * sizeof(int16_t));
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
     for (level = 0; level < PTL_MAIT_NUM_LEVEL; level++) {
         for (vts = 0; vts <= nr_of_vtss; vts++) {
@@ -938,22 +957,22 @@ static void write_pf_level(AVIOContext *pb, int64_t offset,
     }
 
     for (i = 0; i < map_size; i++)
-        avio_wb16(pb, pf_temp[i]);
+        buf_wb16(pb, pf_temp[i]);
     av_free(pf_temp);
 }
 
-static void write_ptl_mait(AVIOContext *pb, int64_t offset,
+static void write_ptl_mait(IFOBuffer *pb, int64_t offset,
                            ptl_mait_t *ptl_mait)
 {
     int i;
 
     // map_size = (ptl_mait->last_byte + 1 - PTL_MAIT_SIZE) / PTL_MAIT_COUNTRY_SIZE;
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb16(pb, ptl_mait->nr_of_countries);
-    avio_wb16(pb, ptl_mait->nr_of_vtss);
-    avio_wb32(pb, ptl_mait->last_byte);
+    buf_wb16(pb, ptl_mait->nr_of_countries);
+    buf_wb16(pb, ptl_mait->nr_of_vtss);
+    buf_wb32(pb, ptl_mait->last_byte);
 
     for (i = 0; i < ptl_mait->nr_of_countries; i++) {
         write_ptl_mait_country(pb, ptl_mait->countries + i);
@@ -966,137 +985,124 @@ static void write_ptl_mait(AVIOContext *pb, int64_t offset,
     }
 }
 
-static void write_vts_attribute(AVIOContext *pb, int64_t offset,
+static void write_vts_attribute(IFOBuffer *pb, int64_t offset,
                                 vts_attributes_t *vts_attributes)
 {
     int i;
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb32(pb, vts_attributes->last_byte);
-    avio_wb32(pb, vts_attributes->vts_cat);
+    buf_wb32(pb, vts_attributes->last_byte);
+    buf_wb32(pb, vts_attributes->vts_cat);
     write_video_attr(pb, &vts_attributes->vtsm_vobs_attr);
-    avio_w8(pb, 0);
-    avio_w8(pb, vts_attributes->nr_of_vtsm_audio_streams);
+    buf_w8(pb, 0);
+    buf_w8(pb, vts_attributes->nr_of_vtsm_audio_streams);
     write_audio_attr(pb, &vts_attributes->vtsm_audio_attr);
-    for (i = 0; i < 7 * sizeof(audio_attr_t); i++)
-        avio_w8(pb, 0);
-    for (i = 0; i < 16; i++)
-        avio_w8(pb, 0);
-    avio_w8(pb, 0);
-    avio_w8(pb, vts_attributes->nr_of_vtsm_subp_streams);
+    buf_zero(pb, 7 * sizeof(audio_attr_t));
+    buf_zero(pb, 16);
+    buf_w8(pb, 0);
+    buf_w8(pb, vts_attributes->nr_of_vtsm_subp_streams);
     write_subp_attr(pb, &vts_attributes->vtsm_subp_attr);
-    for (i = 0; i < 27 * sizeof(subp_attr_t); i++)
-        avio_w8(pb, 0);
-    avio_wb16(pb, 0);
+    buf_zero(pb, 27 * sizeof(subp_attr_t));
+    buf_wb16(pb, 0);
     write_video_attr(pb, &vts_attributes->vtstt_vobs_video_attr);
-    avio_w8(pb, 0);
-    avio_w8(pb, vts_attributes->nr_of_vtstt_audio_streams);
+    buf_w8(pb, 0);
+    buf_w8(pb, vts_attributes->nr_of_vtstt_audio_streams);
     for (i = 0; i < 8; i++)
         write_audio_attr(pb, &vts_attributes->vtstt_audio_attr[i]);
-    for (i = 0; i < 16; i++)
-        avio_w8(pb, 0);
-    avio_w8(pb, 0);
-    avio_w8(pb, vts_attributes->nr_of_vtstt_subp_streams);
+    buf_zero(pb, 16);
+    buf_w8(pb, 0);
+    buf_w8(pb, vts_attributes->nr_of_vtstt_subp_streams);
     for (i = 0; i < 32; i++)
          write_subp_attr(pb, &vts_attributes->vtstt_subp_attr[i]);
 }
 
-static void write_vts_atrt(AVIOContext *pb, int64_t offset,
+static void write_vts_atrt(IFOBuffer *pb, int64_t offset,
                            vts_atrt_t *vts_atrt)
 {
     int i;
 
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_wb16(pb, vts_atrt->nr_of_vtss);
-    avio_wb16(pb, 0);
-    avio_wb32(pb, vts_atrt->last_byte);
+    buf_wb16(pb, vts_atrt->nr_of_vtss);
+    buf_wb16(pb, 0);
+    buf_wb32(pb, vts_atrt->last_byte);
 
     for (i = 0; i < vts_atrt->nr_of_vtss; i++)
-        avio_wb32(pb, vts_atrt->vts_atrt_offsets[i]);
+        buf_wb32(pb, vts_atrt->vts_atrt_offsets[i]);
 
     for (i = 0; i < vts_atrt->nr_of_vtss; i++)
         write_vts_attribute(pb, offset + vts_atrt->vts_atrt_offsets[i],
                             vts_atrt->vts + i);
 }
 
-static void write_txtdt_mgi(AVIOContext *pb, int64_t offset,
+static void write_txtdt_mgi(IFOBuffer *pb, int64_t offset,
                             txtdt_mgi_t *txtdt_mgi)
 {
-    avio_seek(pb, offset, SEEK_SET);
+    buf_seek(pb, offset);
 
-    avio_write(pb, (uint8_t *)txtdt_mgi, sizeof(*txtdt_mgi)); //FIXME
+    buf_write(pb, (uint8_t *)txtdt_mgi, sizeof(*txtdt_mgi)); //FIXME
 }
 
 static int ifo_write_vgm(IFOContext *ifo)
 {
-    AVIOContext *pb  = ifo->pb;
+    IFOBuffer *pb    = &ifo->pb;
     vmgi_mat_t *vmgi = ifo->i->vmgi_mat;
-    int i;
 
-    avio_printf(pb, "%s", "DVDVIDEO-VMG");
+    buf_write(pb, (const uint8_t *)"DVDVIDEO-VMG", 12);
 
-    avio_wb32(pb, vmgi->vmg_last_sector);
+    buf_wb32(pb, vmgi->vmg_last_sector);
 
-    for (i = 0; i < 12; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 12);
 
-    avio_wb32(pb, vmgi->vmgi_last_sector);
-    avio_w8(pb, 0);
+    buf_wb32(pb, vmgi->vmgi_last_sector);
+    buf_w8(pb, 0);
 
-    avio_w8(pb, vmgi->specification_version);
-    avio_wb32(pb, vmgi->vmg_category);
-    avio_wb16(pb, vmgi->vmg_nr_of_volumes);
-    avio_wb16(pb, vmgi->vmg_this_volume_nr);
+    buf_w8(pb, vmgi->specification_version);
+    buf_wb32(pb, vmgi->vmg_category);
+    buf_wb16(pb, vmgi->vmg_nr_of_volumes);
+    buf_wb16(pb, vmgi->vmg_this_volume_nr);
 
-    avio_w8(pb, vmgi->disc_side);
+    buf_w8(pb, vmgi->disc_side);
 
-    for (i = 0; i < 19; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 19);
 
-    avio_wb16(pb, vmgi->vmg_nr_of_title_sets);
-    avio_write(pb, (uint8_t *)vmgi->provider_identifier, 32);
+    buf_wb16(pb, vmgi->vmg_nr_of_title_sets);
+    buf_write(pb, (uint8_t *)vmgi->provider_identifier, 32);
 
-    avio_wb64(pb, vmgi->vmg_pos_code);
+    buf_wb64(pb, vmgi->vmg_pos_code);
 
-    for (i = 0; i < 24; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 24);
 
-    avio_wb32(pb, vmgi->vmgi_last_byte);
-    avio_wb32(pb, vmgi->first_play_pgc);
+    buf_wb32(pb, vmgi->vmgi_last_byte);
+    buf_wb32(pb, vmgi->first_play_pgc);
 
-    for (i = 0; i < 56; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 56);
 
-    avio_wb32(pb, vmgi->vmgm_vobs);
-    avio_wb32(pb, vmgi->tt_srpt);
-    avio_wb32(pb, vmgi->vmgm_pgci_ut);
-    avio_wb32(pb, vmgi->ptl_mait);
-    avio_wb32(pb, vmgi->vts_atrt);
-    avio_wb32(pb, vmgi->txtdt_mgi);
-    avio_wb32(pb, vmgi->vmgm_c_adt);
-    avio_wb32(pb, vmgi->vmgm_vobu_admap);
+    buf_wb32(pb, vmgi->vmgm_vobs);
+    buf_wb32(pb, vmgi->tt_srpt);
+    buf_wb32(pb, vmgi->vmgm_pgci_ut);
+    buf_wb32(pb, vmgi->ptl_mait);
+    buf_wb32(pb, vmgi->vts_atrt);
+    buf_wb32(pb, vmgi->txtdt_mgi);
+    buf_wb32(pb, vmgi->vmgm_c_adt);
+    buf_wb32(pb, vmgi->vmgm_vobu_admap);
 
-    for (i = 0; i < 32; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 32);
 
     write_video_attr(pb, &vmgi->vmgm_video_attr);
-    avio_w8(pb, 0);
-    avio_w8(pb, vmgi->nr_of_vmgm_audio_streams);
+    buf_w8(pb, 0);
+    buf_w8(pb, vmgi->nr_of_vmgm_audio_streams);
 
     write_audio_attr(pb, &vmgi->vmgm_audio_attr);
-    for (i = 0; i < 7 * sizeof(audio_attr_t); i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 7 * sizeof(audio_attr_t));
 
-    for (i = 0; i < 17; i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 17);
 
-    avio_w8(pb, vmgi->nr_of_vmgm_subp_streams);
+    buf_w8(pb, vmgi->nr_of_vmgm_subp_streams);
 
     write_subp_attr(pb, &vmgi->vmgm_subp_attr);
-    for (i = 0; i < 27 * sizeof(subp_attr_t); i++)
-        avio_w8(pb, 0);
+    buf_zero(pb, 27 * sizeof(subp_attr_t));
 
     if (vmgi->first_play_pgc)
         write_pgc(pb, vmgi->first_play_pgc,
@@ -1130,22 +1136,23 @@ static int ifo_write_vgm(IFOContext *ifo)
     return 0;
 }
 
-static void update_values(IFOContext *ifo,
-                          const char *dst_path,
-                          int idx)
+static void update_values(IFOContext *ifo, int idx, int64_t ifo_bytes)
 {
+    TitleSetLayout *ts = ifo->layout->ts + idx;
     int bup_last_sector;
     int menu_sector, title_sector, ifo_sector;
 
-    ifo_sector   = to_sector(ifo_size(dst_path, idx));
-    menu_sector  = to_sector(menu_size(dst_path, idx));
-    title_sector = to_sector(title_size(dst_path, idx));
+    ts->ifo_size = ifo_bytes;
+
+    ifo_sector   = size_to_sectors(ts->ifo_size);
+    menu_sector  = size_to_sectors(ts->menu_size);
+    title_sector = size_to_sectors(ts->title_size);
 
     av_log(NULL, AV_LOG_INFO|AV_LOG_C(111),
            "ifo %d, menu %d title %d\n",
            ifo_sector, menu_sector, title_sector);
 
-    bup_last_sector = title_set_sector(dst_path, idx);
+    bup_last_sector = title_set_sectors(ts);
 
     if (ifo->i->vtsi_mat) {
         av_log(NULL, AV_LOG_INFO, "last_sector (vts) %08x %08x\n",
@@ -1171,45 +1178,54 @@ static void update_values(IFOContext *ifo,
     }
 }
 
+/*
+ * Serialize the IFO in memory, padded to a whole sector.
+ */
 static int ifo_write(IFOContext *ifo, int idx)
 {
-    int ret, i, len;
+    int ret;
+
+    ifo->pb.pos  = 0;
+    ifo->pb.size = 0;
+    if (ifo->pb.data)
+        memset(ifo->pb.data, 0, ifo->pb.allocated);
 
     if (idx)
         ret = ifo_write_vts(ifo);
     else
         ret = ifo_write_vgm(ifo);
 
-    len = to_sector(avio_tell(ifo->pb)) * DVD_BLOCK_LEN - avio_tell(ifo->pb);
-
-    for (i = 0; i < len; i++)
-        avio_w8(ifo->pb, 0);
-
-    avio_flush(ifo->pb);
-
-    avio_close(ifo->pb);
+    buf_seek(&ifo->pb, ifo->pb.size);
+    buf_zero(&ifo->pb, size_to_sectors(ifo->pb.size) * DVD_BLOCK_LEN -
+                       ifo->pb.size);
 
     return ret;
 }
 
-static void patch_tt_srpt(IFOContext *ifo,
-                          const char *dst_path)
+/*
+ * The VMG is the last IFO written, the title set sectors follow its
+ * final size.
+ */
+static void patch_tt_srpt(IFOContext *ifo, int64_t ifo_bytes)
 {
-    vmgi_mat_t *vmgi_mat   = ifo->i->vmgi_mat;
-    tt_srpt_t *tt_srpt     = ifo->i->tt_srpt;
-    int i, sector          = 0;
-    int32_t *title_sectors = av_malloc(vmgi_mat->vmg_nr_of_title_sets *
-                                       sizeof(int32_t));
+    DiscLayout *l      = ifo->layout;
+    tt_srpt_t *tt_srpt = ifo->i->tt_srpt;
+    int i, sector;
 
-    for (i = 0; i < vmgi_mat->vmg_nr_of_title_sets; i++) {
-        sector += title_set_sector(dst_path, i);
-        title_sectors[i] = sector;
-    }
+    l->ts[0].ifo_size = ifo_bytes;
+    plan_disc_layout(l);
 
     for (i = 0; i < tt_srpt->nr_of_srpts; i++) {
-        sector = title_sectors[tt_srpt->title[i].title_set_nr - 1];
-        av_log(NULL, AV_LOG_INFO, "title_set_sector %d ",
-               tt_srpt->title[i].title_set_nr - 1);
+        int nr = tt_srpt->title[i].title_set_nr;
+
+        if (nr < 1 || nr > l->nb_title_sets) {
+            av_log(NULL, AV_LOG_ERROR, "Title %d in the missing set %d\n",
+                   i + 1, nr);
+            continue;
+        }
+
+        sector = l->ts[nr].start_sector;
+        av_log(NULL, AV_LOG_INFO, "title_set_sector %d ", nr - 1);
         av_log(NULL, AV_LOG_INFO|AV_LOG_C(121),
                "0x%08x -> 0x%08x\n",
                tt_srpt->title[i].title_set_sector,
@@ -1218,18 +1234,15 @@ static void patch_tt_srpt(IFOContext *ifo,
     }
 }
 
-static void patch_c_adt(c_adt_t *c_adt, CELL *cells, int nb_cells)
+static void patch_c_adt(c_adt_t *c_adt, CellIndex *ci)
 {
     int i, map_size, missing_cell = 0;
 
     map_size = (c_adt->last_byte + 1 - C_ADT_SIZE) / sizeof(cell_adr_t);
 
-
-
     for (i = 0; i < map_size; i++) {
-        CELL *c = match_cell(cells, nb_cells,
-                             c_adt->cell_adr_table[i].vob_id,
-                             c_adt->cell_adr_table[i].cell_id);
+        CELL *c = find_cell(ci, c_adt->cell_adr_table[i].vob_id,
+                            c_adt->cell_adr_table[i].cell_id);
         if (c) {
             av_log(NULL, AV_LOG_VERBOSE, "vob_id %d, cell_id %d",
                    c_adt->cell_adr_table[i].vob_id,
@@ -1247,14 +1260,108 @@ static void patch_c_adt(c_adt_t *c_adt, CELL *cells, int nb_cells)
         } else {
             missing_cell++;
         }
+    }
 
-        if (missing_cell > 1) {
-            av_log(NULL, AV_LOG_ERROR, "Missing %d cells, aborting.\n",
-                   missing_cell);
+    c_adt->last_byte = (map_size - missing_cell) * sizeof(cell_adr_t) -
+                       1 + C_ADT_SIZE;
+}
+
+// Discontinuity flag of a time map entry.
+#define TMAP_DISCONT 0x80000000U
+
+static int vobu_at_sector(VOBU *vobus, int nb_vobus, uint32_t sector)
+{
+    int lo = 0, hi = nb_vobus;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (vobus[mid].start_sector < sector)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * Entry k points to the VOBU playing at (k + 1) * tmu seconds in the PGC,
+ * flagged if it belongs to another cell than the entry before.
+ * The maps never grow so the table keeps its layout, the PGCs with
+ * angle blocks are left alone.
+ */
+static void patch_tmap(vts_tmap_t *tmap, pgc_t *pgc, CellIndex *ci,
+                       VOBU *vobus, int nb_vobus)
+{
+    int64_t step = tmap->tmu * 90000LL, elapsed = 0;
+    VOBU *prev   = NULL;
+    uint32_t *map_ent;
+    int i, k = 0;
+
+    if (!tmap->tmu || !tmap->nr_of_entries || !pgc || !pgc->cell_playback)
+        return;
+
+    for (i = 0; i < pgc->nr_of_cells; i++)
+        if (pgc->cell_playback[i].block_type == BLOCK_TYPE_ANGLE_BLOCK)
+            return;
+
+    // Built aside, the original map stays if a cell is missing.
+    map_ent = av_malloc(tmap->nr_of_entries * sizeof(*map_ent));
+    if (!map_ent)
+        return;
+
+    for (i = 0; i < pgc->nr_of_cells && k < tmap->nr_of_entries; i++) {
+        CELL *c = find_cell(ci, pgc->cell_position[i].vob_id_nr,
+                            pgc->cell_position[i].cell_nr);
+        int j;
+
+        if (!c) {
+            av_log(NULL, AV_LOG_WARNING,
+                   "Cell %d/%d missing, time map left as is\n",
+                   pgc->cell_position[i].vob_id_nr,
+                   pgc->cell_position[i].cell_nr);
+            av_free(map_ent);
+            return;
+        }
+
+        for (j = vobu_at_sector(vobus, nb_vobus, c->start_sector);
+             j < nb_vobus && vobus[j].start_sector <= c->last_sector; j++) {
+            VOBU *v = vobus + j;
+
+            elapsed += vobu_duration(v);
+
+            while (k < tmap->nr_of_entries && (k + 1) * step < elapsed) {
+                uint32_t ent = v->start_sector;
+
+                if (prev && (prev->vob_id != v->vob_id ||
+                             prev->cell_id != v->cell_id))
+                    ent |= TMAP_DISCONT;
+
+                map_ent[k++] = ent;
+                prev = v;
+            }
         }
-        c_adt->last_byte = (map_size - missing_cell) * sizeof(cell_adr_t) -
-                           1 + C_ADT_SIZE;
     }
+
+    if (k != tmap->nr_of_entries)
+        av_log(NULL, AV_LOG_WARNING, "Time map shortened from %d to %d\n",
+               tmap->nr_of_entries, k);
+
+    memcpy(tmap->map_ent, map_ent, k * sizeof(*map_ent));
+    tmap->nr_of_entries = k;
+
+    av_free(map_ent);
+}
+
+static void patch_vts_tmapt(vts_tmapt_t *tmapt, pgcit_t *pgcit,
+                            CellIndex *ci, VOBU *vobus, int nb_vobus)
+{
+    int i;
+
+    for (i = 0; i < tmapt->nr_of_tmaps && i < pgcit->nr_of_pgci_srp; i++)
+        patch_tmap(tmapt->tmap + i, pgcit->pgci_srp[i].pgc, ci,
+                   vobus, nb_vobus);
 }
 
 void patch_vobu_admap(vobu_admap_t *vobu_admap, VOBU *vobus, int nb_vobus)
@@ -1291,29 +1398,150 @@ void patch_vobu_admap(vobu_admap_t *vobu_admap, VOBU *vobus, int nb_vobus)
     }
 }
 
+/*
+ * Move the stream controls as make_vob moved the streams, an entry is
+ * dropped if the stream it refers to is.
+ */
+static void strip_pgc(pgc_t *pgc, const PackFilter *f)
+{
+    uint16_t audio[8]  = { 0 };
+    uint32_t subp[32]  = { 0 };
+    int i, j;
+
+    for (i = 0; i < 8; i++) {
+        uint16_t c = pgc->audio_control[i];
+        int n      = (c >> 8) & 7;
+
+        if (!(c & 0x8000) || f->audio[i] < 0 || f->audio[n] < 0)
+            continue;
+
+        audio[f->audio[i]] = (c & ~0x0700) | (f->audio[n] << 8);
+    }
+
+    for (i = 0; i < 32; i++) {
+        uint32_t c = pgc->subp_control[i];
+        int first  = f->subp[(c >> 24) & 0x1f];
+
+        if (!(c & 0x80000000) || f->subp[i] < 0 || first < 0)
+            continue;
+
+        // 4:3, wide, letterbox and pan&scan stream numbers
+        for (j = 24; j >= 0; j -= 8) {
+            int n = f->subp[(c >> j) & 0x1f];
+
+            c = (c & ~(0x1fU << j)) | ((uint32_t)(n < 0 ? first : n) << j);
+        }
+
+        subp[f->subp[i]] = c;
+    }
+
+    memcpy(pgc->audio_control, audio, sizeof(audio));
+    memcpy(pgc->subp_control, subp, sizeof(subp));
+}
+
+/*
+ * Compact the title stream attributes and the PGC controls to the streams
+ * kept, the menus are left alone.
+ */
+static void strip_streams(ifo_handle_t *ifo, const PackFilter *f)
+{
+    vtsi_mat_t *vtsi = ifo->vtsi_mat;
+    audio_attr_t audio[8]     = { { 0 } };
+    multichannel_ext_t mu[8]  = { { 0 } };
+    subp_attr_t subp[32]      = { { 0 } };
+    int i, nb_audio = 0, nb_subp = 0;
+
+    for (i = 0; i < FFMIN(vtsi->nr_of_vts_audio_streams, 8); i++) {
+        if (f->audio[i] < 0)
+            continue;
+        audio[f->audio[i]] = vtsi->vts_audio_attr[i];
+        mu[f->audio[i]]    = vtsi->vts_mu_audio_attr[i];
+        nb_audio++;
+    }
+
+    for (i = 0; i < FFMIN(vtsi->nr_of_vts_subp_streams, 32); i++) {
+        if (f->subp[i] < 0)
+            continue;
+        subp[f->subp[i]] = vtsi->vts_subp_attr[i];
+        nb_subp++;
+    }
+
+    av_log(NULL, AV_LOG_INFO, "audio streams %d -> %d, subpicture %d -> %d\n",
+           vtsi->nr_of_vts_audio_streams, nb_audio,
+           vtsi->nr_of_vts_subp_streams, nb_subp);
+
+    memcpy(vtsi->vts_audio_attr, audio, sizeof(audio));
+    memcpy(vtsi->vts_mu_audio_attr, mu, sizeof(mu));
+    memcpy(vtsi->vts_subp_attr, subp, sizeof(subp));
+    vtsi->nr_of_vts_audio_streams = nb_audio;
+    vtsi->nr_of_vts_subp_streams  = nb_subp;
+
+    for (i = 0; i < ifo->vts_pgcit->nr_of_pgci_srp; i++)
+        strip_pgc(ifo->vts_pgcit->pgci_srp[i].pgc, f);
+}
+
+/*
+ * The VMG keeps a copy of the title set attributes, refresh it from the
+ * title IFOs already rewritten in dst.
+ */
+static void sync_vts_atrt(ifo_handle_t *vmg, const char *dst_path)
+{
+    vts_atrt_t *vts_atrt = vmg->vts_atrt;
+    dvd_reader_t *dvd;
+    int i;
+
+    if (!vts_atrt || !(dvd = DVDOpen(dst_path)))
+        return;
+
+    for (i = 0; i < vts_atrt->nr_of_vtss; i++) {
+        vts_attributes_t *a = vts_atrt->vts + i;
+        ifo_handle_t *vts   = ifoOpenVTSI(dvd, i + 1);
+
+        if (!vts)
+            continue;
+
+        a->nr_of_vtstt_audio_streams = vts->vtsi_mat->nr_of_vts_audio_streams;
+        a->nr_of_vtstt_subp_streams  = vts->vtsi_mat->nr_of_vts_subp_streams;
+        memcpy(a->vtstt_audio_attr, vts->vtsi_mat->vts_audio_attr,
+               sizeof(a->vtstt_audio_attr));
+        memcpy(a->vtstt_subp_attr, vts->vtsi_mat->vts_subp_attr,
+               sizeof(a->vtstt_subp_attr));
+
+        ifoClose(vts);
+    }
+
+    DVDClose(dvd);
+}
+
 int fix_title(IFOContext *ifo, const char* path, int idx)
 {
-    char title[1024];
+    char title[4096];
     VOBU *vobus;
     int nb_vobus;
-    CELL *cells;
-    int nb_cells;
+    CellIndex ci;
 
-    snprintf(title, sizeof(title), "%s/VIDEO_TS/VTS_%02d_1.VOB", path, idx);
+    title_parts(title, sizeof(title), path, idx);
 
     if ((nb_vobus = populate_vobs(&vobus, title)) < 0)
         return -1;
 
-    if ((nb_cells = populate_cells(&cells, vobus, nb_vobus)) < 0)
+    if (populate_cell_index(&ci, vobus, nb_vobus) < 0)
         return -1;
 
     if (ifo->i->vts_c_adt)
-        patch_c_adt(ifo->i->vts_c_adt, cells, nb_cells);
+        patch_c_adt(ifo->i->vts_c_adt, &ci);
 
     if (ifo->i->vts_vobu_admap)
         patch_vobu_admap(ifo->i->vts_vobu_admap, vobus, nb_vobus);
 
-    patch_pgcit(ifo->i->vts_pgcit, cells, nb_cells);
+    patch_pgcit(ifo->i->vts_pgcit, &ci);
+
+    if (ifo->i->vts_tmapt)
+        patch_vts_tmapt(ifo->i->vts_tmapt, ifo->i->vts_pgcit, &ci,
+                        vobus, nb_vobus);
+
+    report_missing_cells(&ci, "the title");
+    free_cell_index(&ci);
 
     return 0;
 }
@@ -1323,8 +1551,7 @@ int fix_menu(IFOContext *ifo, const char *path, int idx)
     char menu[1024];
     VOBU *vobus;
     int nb_vobus;
-    CELL *cells;
-    int nb_cells;
+    CellIndex ci;
 
     if (idx)
         snprintf(menu, sizeof(menu), "%s/VIDEO_TS/VTS_%02d_0.VOB", path, idx);
@@ -1334,64 +1561,516 @@ int fix_menu(IFOContext *ifo, const char *path, int idx)
     if ((nb_vobus = populate_vobs(&vobus, menu)) < 0)
         return -1;
 
-    if ((nb_cells = populate_cells(&cells, vobus, nb_vobus)) < 0)
+    if (populate_cell_index(&ci, vobus, nb_vobus) < 0)
         return -1;
 
     if (ifo->i->menu_c_adt)
-        patch_c_adt(ifo->i->menu_c_adt, cells, nb_cells);
+        patch_c_adt(ifo->i->menu_c_adt, &ci);
 
     if (ifo->i->menu_vobu_admap)
         patch_vobu_admap(ifo->i->menu_vobu_admap, vobus, nb_vobus);
 
-    patch_pgci_ut(ifo->i->pgci_ut, cells, nb_cells);
+    patch_pgci_ut(ifo->i->pgci_ut, &ci);
+
+    report_missing_cells(&ci, "the menu");
+    free_cell_index(&ci);
 
     return 0;
 }
 
-int main(int argc, char **argv)
+/*
+ * The destination IFO mapped for the minimal patch, the checks only read
+ * and the patch writes the fields that differ.
+ */
+typedef struct IFOMap {
+    uint8_t *data;
+    int64_t size;
+    int write;
+    int changed;
+    int error;
+} IFOMap;
+
+static uint8_t *map_at(IFOMap *m, int64_t offset, int len)
 {
-    IFOContext *ifo = NULL;
-    dvd_reader_t *dvd;
-    int ret, idx = 0;
-    const char *src_path, *dst_path;
+    if (offset < 0 || offset + len > m->size) {
+        m->error = 1;
+        return NULL;
+    }
 
-    av_register_all();
+    return m->data + offset;
+}
 
-    if (argc < 4)
-        help(argv[0]);
+static void map_wb32(IFOMap *m, int64_t offset, uint32_t v)
+{
+    uint8_t *p = map_at(m, offset, 4);
 
-    src_path = argv[1];
-    dst_path = argv[2];
-    idx = atoi(argv[3]);
+    if (!p || !m->write || AV_RB32(p) == v)
+        return;
+
+    AV_WB32(p, v);
+    m->changed++;
+}
+
+static void map_check32(IFOMap *m, int64_t offset, uint32_t v)
+{
+    uint8_t *p = map_at(m, offset, 4);
+
+    if (p && !m->write && AV_RB32(p) != v)
+        m->error = 1;
+}
+
+static void map_pgcit(IFOMap *m, int64_t offset, pgcit_t *pgcit)
+{
+    int i, j;
+
+    for (i = 0; i < pgcit->nr_of_pgci_srp; i++) {
+        pgc_t *pgc    = pgcit->pgci_srp[i].pgc;
+        int64_t base  = offset + pgcit->pgci_srp[i].pgc_start_byte;
+        uint8_t *hdr  = map_at(m, base, PGC_SIZE);
+
+        if (!hdr || !pgc->cell_playback)
+            continue;
+
+        if (!m->write && hdr[3] != pgc->nr_of_cells)
+            m->error = 1;
+
+        for (j = 0; j < pgc->nr_of_cells; j++) {
+            int64_t c = base + pgc->cell_playback_offset + 24 * j;
+
+            map_wb32(m, c + 8,  pgc->cell_playback[j].first_sector);
+            map_wb32(m, c + 16, pgc->cell_playback[j].last_vobu_start_sector);
+            map_wb32(m, c + 20, pgc->cell_playback[j].last_sector);
+        }
+    }
+}
+
+static void map_pgci_ut(IFOMap *m, int64_t offset, pgci_ut_t *pgci_ut)
+{
+    int i;
+
+    for (i = 0; pgci_ut && i < pgci_ut->nr_of_lus; i++)
+        map_pgcit(m, offset + pgci_ut->lu[i].lang_start_byte,
+                  pgci_ut->lu[i].pgcit);
+}
+
+static void map_c_adt(IFOMap *m, int64_t offset, c_adt_t *c_adt)
+{
+    int i, map_size = (c_adt->last_byte + 1 - C_ADT_SIZE) / sizeof(cell_adr_t);
+
+    map_check32(m, offset + 4, c_adt->last_byte);
+
+    for (i = 0; i < map_size; i++) {
+        map_wb32(m, offset + 8 + 12 * i + 4,
+                 c_adt->cell_adr_table[i].start_sector);
+        map_wb32(m, offset + 8 + 12 * i + 8,
+                 c_adt->cell_adr_table[i].last_sector);
+    }
+}
+
+static void map_tmapt(IFOMap *m, int64_t offset, vts_tmapt_t *tmapt)
+{
+    int i, j;
+
+    for (i = 0; i < tmapt->nr_of_tmaps; i++) {
+        vts_tmap_t *tmap = tmapt->tmap + i;
+        int64_t base     = offset + tmapt->tmap_offset[i];
+
+        map_check32(m, base, tmap->tmu << 24 | tmap->nr_of_entries);
+
+        for (j = 0; j < tmap->nr_of_entries; j++)
+            map_wb32(m, base + 4 + 4 * j, tmap->map_ent[j]);
+    }
+}
+
+static void map_vobu_admap(IFOMap *m, int64_t offset, vobu_admap_t *admap)
+{
+    int i, map_size = (admap->last_byte + 1 - VOBU_ADMAP_SIZE) / sizeof(uint32_t);
+
+    map_check32(m, offset, admap->last_byte);
+
+    for (i = 0; i < map_size; i++)
+        map_wb32(m, offset + 4 + 4 * i, admap->vobu_start_sectors[i]);
+}
+
+/*
+ * Walk the sector fields of the model at their on disk offsets, once to
+ * check that the tables kept their size and once to patch them.
+ */
+static void map_fields(IFOMap *m, ifo_handle_t *i)
+{
+    if (i->vtsi_mat) {
+        vtsi_mat_t *vtsi = i->vtsi_mat;
+
+        map_wb32(m, 0x0c, vtsi->vts_last_sector);
+        map_wb32(m, 0x1c, vtsi->vtsi_last_sector);
+        map_wb32(m, 0xc0, vtsi->vtsm_vobs);
+        map_wb32(m, 0xc4, vtsi->vtstt_vobs);
+
+        if (i->vts_pgcit)
+            map_pgcit(m, vtsi->vts_pgcit * DVD_BLOCK_LEN, i->vts_pgcit);
+        map_pgci_ut(m, vtsi->vtsm_pgci_ut * DVD_BLOCK_LEN, i->pgci_ut);
+        if (i->menu_c_adt)
+            map_c_adt(m, vtsi->vtsm_c_adt * DVD_BLOCK_LEN, i->menu_c_adt);
+        if (i->menu_vobu_admap)
+            map_vobu_admap(m, vtsi->vtsm_vobu_admap * DVD_BLOCK_LEN,
+                           i->menu_vobu_admap);
+        if (i->vts_tmapt)
+            map_tmapt(m, vtsi->vts_tmapt * DVD_BLOCK_LEN, i->vts_tmapt);
+        if (i->vts_c_adt)
+            map_c_adt(m, vtsi->vts_c_adt * DVD_BLOCK_LEN, i->vts_c_adt);
+        if (i->vts_vobu_admap)
+            map_vobu_admap(m, vtsi->vts_vobu_admap * DVD_BLOCK_LEN,
+                           i->vts_vobu_admap);
+    }
+
+    if (i->vmgi_mat) {
+        vmgi_mat_t *vmgi = i->vmgi_mat;
+        int j;
+
+        map_wb32(m, 0x0c, vmgi->vmg_last_sector);
+        map_wb32(m, 0x1c, vmgi->vmgi_last_sector);
+        map_wb32(m, 0xc0, vmgi->vmgm_vobs);
+
+        for (j = 0; i->tt_srpt && j < i->tt_srpt->nr_of_srpts; j++)
+            map_wb32(m, vmgi->tt_srpt * DVD_BLOCK_LEN + 8 + 12 * j + 8,
+                     i->tt_srpt->title[j].title_set_sector);
+
+        map_pgci_ut(m, vmgi->vmgm_pgci_ut * DVD_BLOCK_LEN, i->pgci_ut);
+        if (i->menu_c_adt)
+            map_c_adt(m, vmgi->vmgm_c_adt * DVD_BLOCK_LEN, i->menu_c_adt);
+        if (i->menu_vobu_admap)
+            map_vobu_admap(m, vmgi->vmgm_vobu_admap * DVD_BLOCK_LEN,
+                           i->menu_vobu_admap);
+    }
+}
+
+/*
+ * Patch only the sector fields of the destination IFO in place, it must
+ * be a copy of the source one. AVERROR(EAGAIN) if a table changed size
+ * and the IFO has to be serialized again.
+ */
+static int ifo_patch(IFOContext *ifo, const char *dst_path, int idx)
+{
+    IFOMap m = { NULL };
+    char path[1024];
+    struct stat st;
+    int fd;
+
+    ifo_path(path, sizeof(path), dst_path, "IFO", idx);
+
+    fd = open(path, O_RDWR);
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size != ifo->ifo_size) {
+        if (fd >= 0)
+            close(fd);
+        return AVERROR(EAGAIN);
+    }
+
+    m.size = st.st_size;
+    m.data = mmap(NULL, m.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (m.data == MAP_FAILED) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot map %s\n", path);
+        return AVERROR(errno);
+    }
+
+    if (!idx)
+        patch_tt_srpt(ifo, m.size);
+
+    update_values(ifo, idx, m.size);
+
+    map_fields(&m, ifo->i);
+
+    if (!m.error) {
+        m.write = 1;
+        map_fields(&m, ifo->i);
+        av_log(NULL, AV_LOG_INFO, "Patched %d fields of %s\n",
+               m.changed, path);
+    }
 
-    ifo_open(&ifo, dst_path, idx, AVIO_FLAG_READ_WRITE);
+    munmap(m.data, m.size);
 
+    return m.error ? AVERROR(EAGAIN) : 0;
+}
+
+static int ifo_copy_bup(const char *dst_path, int idx)
+{
+    char path[1024];
+    uint8_t *data;
+    int64_t size;
+    int fd, ret;
+
+    ifo_path(path, sizeof(path), dst_path, "IFO", idx);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return AVERROR(errno);
+
+    size = ifo_size(dst_path, idx);
+    data = av_malloc(size);
+    ret  = data ? read_at(fd, data, size, 0) : AVERROR(ENOMEM);
+    close(fd);
+
+    if (ret >= 0) {
+        IFOContext tmp = { NULL };
+
+        tmp.pb.data = data;
+        tmp.pb.size = size;
+        ret = ifo_store(&tmp, dst_path, "BUP", idx);
+    }
+
+    av_free(data);
+
+    return ret;
+}
+
+/*
+ * Rewrite the IFO idx of dst_path from the one in src_path, the VTS
+ * ones must be done before the VMG since it records their sizes.
+ */
+static int rewrite_ifo(const char *src_path, const char *dst_path, int idx,
+                       DiscLayout *layout, const PackFilter *filter,
+                       int bup, int minimal)
+{
+    IFOContext *ifo = ifo_alloc();
+    dvd_reader_t *dvd;
+    int ret;
+
+    if (!ifo)
+        return AVERROR(ENOMEM);
+
+    ifo->layout = layout;
+
+    // Every call has its own reader, libdvdread handles are not shared.
     dvd = DVDOpen(src_path);
+    if (!dvd) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the path %s\n", src_path);
+        ret = AVERROR(EINVAL);
+        goto end;
+    }
 
     ifo->ifo_size = ifo_size(src_path, idx);
 
     ifo->i = ifoOpen(dvd, idx);
+    if (!ifo->i) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the IFO %d in %s\n",
+               idx, src_path);
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
 
     if (idx) {
         ret = fix_title(ifo, dst_path, idx);
         if (ret < 0)
-            return ret;
+            goto end;
+
+        if (filter)
+            strip_streams(ifo->i, filter);
+    } else {
+        sync_vts_atrt(ifo->i, dst_path);
     }
 
     // menu files can be missing
     fix_menu(ifo, dst_path, idx);
 
+    if (minimal && !filter) {
+        ret = ifo_patch(ifo, dst_path, idx);
+        if (!ret && bup)
+            ret = ifo_copy_bup(dst_path, idx);
+        if (ret != AVERROR(EAGAIN))
+            goto end;
+        av_log(NULL, AV_LOG_INFO, "The tables change size, rewriting\n");
+    }
+
     ret = ifo_write(ifo, idx);
     if (ret < 0)
-        return ret;
+        goto end;
 
     // now we know for sure how big the ifo is.
     if (!idx)
-        patch_tt_srpt(ifo, dst_path);
+        patch_tt_srpt(ifo, ifo->pb.size);
+
+    update_values(ifo, idx, ifo->pb.size);
+
+    if ((ret = ifo_write(ifo, idx)) < 0 ||
+        (ret = ifo_store(ifo, dst_path, "IFO", idx)) < 0 ||
+        (bup && (ret = ifo_store(ifo, dst_path, "BUP", idx)) < 0))
+        goto end;
+
+end:
+    if (ifo->i)
+        ifoClose(ifo->i);
+    if (dvd)
+        DVDClose(dvd);
+    av_free(ifo->pb.data);
+    av_free(ifo);
+
+    return ret;
+}
+
+typedef struct DiscContext {
+    const char *src_path, *dst_path;
+    const PackFilter *filter;
+    int minimal;
+    DiscLayout *layout;
+    int nb_title_sets;
+    int next;
+    int ret;
+    pthread_mutex_t lock;
+} DiscContext;
+
+static void *title_set_worker(void *arg)
+{
+    DiscContext *d = arg;
+    int idx, ret;
+
+    for (;;) {
+        pthread_mutex_lock(&d->lock);
+        idx = ++d->next;
+        pthread_mutex_unlock(&d->lock);
+
+        if (idx > d->nb_title_sets)
+            break;
+
+        av_log(NULL, AV_LOG_INFO, "Processing VTS_%02d_0.IFO\n", idx);
+
+        // Every worker updates only the entry of its title set.
+        if ((ret = rewrite_ifo(d->src_path, d->dst_path, idx, d->layout,
+                               d->filter, 1, d->minimal)) < 0) {
+            pthread_mutex_lock(&d->lock);
+            d->ret = ret;
+            pthread_mutex_unlock(&d->lock);
+        }
+    }
 
-    update_values(ifo, dst_path, idx);
+    return NULL;
+}
+
+/*
+ * Rewrite every title set IFO on nb_threads threads, then the VMG once
+ * their sizes are final, writing the BUP copies along.
+ */
+static int rewrite_disc(const char *src_path, const char *dst_path,
+                        const PackFilter *filter, int nb_threads, int minimal)
+{
+    DiscContext d = { src_path, dst_path, filter, minimal };
+    DiscLayout layout;
+    pthread_t *workers;
+    dvd_reader_t *dvd;
+    ifo_handle_t *vmg;
+    int i, nb_started = 0;
+
+    dvd = DVDOpen(src_path);
+    if (!dvd || !(vmg = ifoOpen(dvd, 0))) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open the VMG in %s\n", src_path);
+        return AVERROR(EINVAL);
+    }
+
+    d.nb_title_sets = vmg->vmgi_mat->vmg_nr_of_title_sets;
+
+    ifoClose(vmg);
+    DVDClose(dvd);
+
+    // The sizes are gathered once, the IFOs update theirs as written,
+    // the destination VIDEO_TS.IFO may not be there yet.
+    scan_disc_layout(&layout, dst_path);
+    layout.nb_title_sets = FFMAX(layout.nb_title_sets, d.nb_title_sets);
+    d.layout = &layout;
+
+    nb_threads = FFMAX(FFMIN(nb_threads, d.nb_title_sets), 1);
+    workers    = av_mallocz(nb_threads * sizeof(*workers));
+    if (!workers)
+        return AVERROR(ENOMEM);
+
+    pthread_mutex_init(&d.lock, NULL);
+
+    for (i = 0; i < nb_threads; i++) {
+        if (pthread_create(workers + i, NULL, title_set_worker, &d)) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot start the thread %d\n", i);
+            pthread_mutex_lock(&d.lock);
+            d.ret = AVERROR(EAGAIN);
+            pthread_mutex_unlock(&d.lock);
+            break;
+        }
+        nb_started++;
+    }
+
+    for (i = 0; i < nb_started; i++)
+        pthread_join(workers[i], NULL);
+
+    pthread_mutex_destroy(&d.lock);
+    av_free(workers);
+
+    if (d.ret < 0)
+        return d.ret;
+
+    av_log(NULL, AV_LOG_INFO, "Processing VIDEO_TS.IFO\n");
 
-    ret = ifo_open_internal(&ifo->pb, dst_path, "IFO", idx, AVIO_FLAG_READ_WRITE);
+    // The filtered title sets change the vts_atrt the minimal patch skips.
+    return rewrite_ifo(src_path, dst_path, 0, &layout, d.filter, 1, minimal);
+}
+
+int main(int argc, char **argv)
+{
+    PackFilter filter;
+    DiscLayout layout;
+    int idx = 0, c, strip = 0, disc = 0, nb_threads = 4, minimal = 0;
+    const char *src_path, *dst_path;
+    char *name = argv[0];
+
+    av_register_all();
+
+    init_pack_filter(&filter);
+
+    while ((c = getopt(argc, argv, "A:P:aj:m")) != -1) {
+        switch (c) {
+        case 'm':
+            minimal = 1;
+            break;
+        case 'A':
+            if (parse_stream_list(filter.audio, 8, optarg) < 0)
+                return 1;
+            strip = 1;
+            break;
+        case 'P':
+            if (parse_stream_list(filter.subp, 32, optarg) < 0)
+                return 1;
+            strip = 1;
+            break;
+        case 'a':
+            disc = 1;
+            break;
+        case 'j':
+            nb_threads = atoi(optarg);
+            break;
+        default:
+            help(name);
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < (disc ? 3 : 4))
+        help(name);
+
+    src_path = argv[1];
+    dst_path = argv[2];
+
+    if (disc)
+        return rewrite_disc(src_path, dst_path,
+                            strip ? &filter : NULL, nb_threads, minimal) < 0;
+
+    idx = atoi(argv[3]);
+
+    scan_disc_layout(&layout, dst_path);
+
+    if (layout.nb_title_sets < idx) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find the title set %d in %s\n",
+               idx, dst_path);
+        return 1;
+    }
 
-    return ifo_write(ifo, idx);
+    return rewrite_ifo(src_path, dst_path, idx, &layout,
+                       strip ? &filter : NULL, 0, minimal);
 }
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+if [[ "$1" = "-h" || "$#" -lt 4 ]];  then
+    echo Usage: $0 /path/to/src /path/to/dst audio_list subp_list
+    echo Keep only the listed streams, e.g. $0 src dst 0,1 0
+    exit 0
+fi
+
+shopt -s nullglob
+
+die(){
+    echo $1 Failed
+    exit 1
+}
+
+SRC="${1}/VIDEO_TS"
+DST="${2}/VIDEO_TS"
+AUDIO="$3"
+SUBP="$4"
+
+mkdir -p ${DST}
+
+cp ${SRC}/*.IFO ${SRC}/VIDEO_TS.VOB ${SRC}/VTS_*_0.VOB ${DST}
+
+for a in ${SRC}/VTS_*_1.VOB; do
+    name=$(basename $a)
+    echo Processing $name
+    cat ${a/_1.VOB/}_[1-9].VOB | \
+        make_vob -S -s -A ${AUDIO} -P ${SUBP} - ${DST}/${name} || \
+        die "make_vob $name"
+done
+
+rewrite_ifo -a -A ${AUDIO} -P ${SUBP} $1 $2 || die "rewrite_ifo"
+check_dvd $2 || die "check_dvd"